@@ -1,7 +1,15 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 #include "background-image.h"
 #include "cairo_util.h"
 #include "log.h"
+#if HAVE_GDK_PIXBUF
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include "pixel-convert.h"
+#endif
 
 enum background_mode parse_background_mode(const char *mode) {
 	if (strcmp(mode, "stretch") == 0) {
@@ -21,34 +29,405 @@ enum background_mode parse_background_mode(const char *mode) {
 	return BACKGROUND_MODE_INVALID;
 }
 
-cairo_surface_t *load_background_image(const char *path) {
-	cairo_surface_t *image;
+const char *background_mode_name(enum background_mode mode) {
+	switch (mode) {
+	case BACKGROUND_MODE_STRETCH:
+		return "stretch";
+	case BACKGROUND_MODE_FILL:
+		return "fill";
+	case BACKGROUND_MODE_FIT:
+		return "fit";
+	case BACKGROUND_MODE_CENTER:
+		return "center";
+	case BACKGROUND_MODE_TILE:
+		return "tile";
+	case BACKGROUND_MODE_SOLID_COLOR:
+		return "solid_color";
+	case BACKGROUND_MODE_INVALID:
+		break;
+	}
+	return "invalid";
+}
+
+static int scale_size(int size, double scale) {
+	double scaled = size * scale;
+	int rounded = (int)scaled;
+	return rounded < scaled ? rounded + 1 : rounded;
+}
+
+void background_image_required_size(int image_width, int image_height,
+		enum background_mode mode, int buffer_width, int buffer_height,
+		int *width, int *height) {
+	*width = image_width;
+	*height = image_height;
+	double scale;
+	switch (mode) {
+	case BACKGROUND_MODE_STRETCH:
+		if (buffer_width < image_width) {
+			*width = buffer_width;
+		}
+		if (buffer_height < image_height) {
+			*height = buffer_height;
+		}
+		return;
+	case BACKGROUND_MODE_FILL:
+		scale = (double)buffer_width / image_width;
+		if ((double)buffer_height / image_height > scale) {
+			scale = (double)buffer_height / image_height;
+		}
+		break;
+	case BACKGROUND_MODE_FIT:
+		scale = (double)buffer_width / image_width;
+		if ((double)buffer_height / image_height < scale) {
+			scale = (double)buffer_height / image_height;
+		}
+		break;
+	default:
+		// Drawn pixel for pixel
+		return;
+	}
+	if (scale < 1.0) {
+		*width = scale_size(image_width, scale);
+		*height = scale_size(image_height, scale);
+	}
+}
+
+// The size closest to size with the same parity as buffer_size, so that the
+// image is centered on whole pixels. Grows if the image must cover the buffer.
+static int match_parity(int size, int buffer_size, bool cover) {
+	if (size < 1) {
+		size = 1;
+	}
+	if ((buffer_size - size) % 2 == 0) {
+		return size;
+	}
+	return cover || size == 1 ? size + 1 : size - 1;
+}
+
+bool background_image_scaled_size(int image_width, int image_height,
+		enum background_mode mode, int buffer_width, int buffer_height,
+		int *width, int *height) {
+	double scale_x = (double)buffer_width / image_width;
+	double scale_y = (double)buffer_height / image_height;
+	switch (mode) {
+	case BACKGROUND_MODE_STRETCH:
+		*width = buffer_width;
+		*height = buffer_height;
+		return scale_x < 1.0 || scale_y < 1.0;
+	case BACKGROUND_MODE_FILL:
+	case BACKGROUND_MODE_FIT:;
+		bool fill = mode == BACKGROUND_MODE_FILL;
+		if ((scale_x > scale_y) == fill) {
+			*width = buffer_width;
+			*height = match_parity(
+					(int)(image_height * scale_x + 0.5), buffer_height, fill);
+		} else {
+			*width = match_parity(
+					(int)(image_width * scale_y + 0.5), buffer_width, fill);
+			*height = buffer_height;
+		}
+		return *width < image_width || *height < image_height;
+	default:
+		return false;
+	}
+}
+
+// The smallest size that serves all targets, the full size if there are none
+static void get_decode_size(int image_width, int image_height,
+		const struct background_target *targets, int count,
+		int *width, int *height) {
+	*width = count ? 0 : image_width;
+	*height = count ? 0 : image_height;
+	bool keep_aspect = false;
+	for (int i = 0; i < count; ++i) {
+		int w, h;
+		background_image_required_size(image_width, image_height,
+				targets[i].mode, targets[i].width, targets[i].height, &w, &h);
+		*width = w > *width ? w : *width;
+		*height = h > *height ? h : *height;
+		keep_aspect |= targets[i].mode != BACKGROUND_MODE_STRETCH;
+	}
+	if (keep_aspect) {
+		double scale = (double)*width / image_width;
+		if ((double)*height / image_height > scale) {
+			scale = (double)*height / image_height;
+		}
+		*width = scale_size(image_width, scale);
+		*height = scale_size(image_height, scale);
+	}
+	if (*width > image_width || *height > image_height) {
+		*width = image_width;
+		*height = image_height;
+	}
+}
+
 #if HAVE_GDK_PIXBUF
+/*
+ * Center and tile only ever show the part of a big image that fits the
+ * largest buffer, so only that part needs to be kept.
+ */
+static bool get_crop(int image_width, int image_height,
+		const struct background_target *targets, int count,
+		enum background_mode *mode, cairo_rectangle_int_t *crop) {
+	if (count == 0 || (targets[0].mode != BACKGROUND_MODE_CENTER &&
+			targets[0].mode != BACKGROUND_MODE_TILE)) {
+		return false;
+	}
+	*mode = targets[0].mode;
+	int width = 0, height = 0;
+	for (int i = 0; i < count; ++i) {
+		if (targets[i].mode != *mode) {
+			return false;
+		}
+		width = targets[i].width > width ? targets[i].width : width;
+		height = targets[i].height > height ? targets[i].height : height;
+	}
+	if (width >= image_width && height >= image_height) {
+		return false;
+	}
+	bool center = *mode == BACKGROUND_MODE_CENTER;
+	// Centered crops keep the parity of the image, so that it stays on the
+	// same pixel grid
+	if (width >= image_width) {
+		width = image_width;
+	} else if (center && (image_width - width) % 2) {
+		width++;
+	}
+	if (height >= image_height) {
+		height = image_height;
+	} else if (center && (image_height - height) % 2) {
+		height++;
+	}
+	crop->x = center ? (image_width - width) / 2 : 0;
+	crop->y = center ? (image_height - height) / 2 : 0;
+	crop->width = width;
+	crop->height = height;
+	return true;
+}
+
+// Feeding the loader this much at a time keeps the file out of memory
+#define LOAD_CHUNK_SIZE (64 * 1024)
+
+/*
+ * Rows are converted into the cairo layout as soon as the loader has decoded
+ * them. The loader keeps its own pixbuf of the decoded size until it is
+ * closed, so memory is only saved when a crop is kept: then only the cropped
+ * rows are copied.
+ */
+struct image_stream {
+	const struct background_target *targets;
+	int count;
+	struct background_image_info *info;
+	cairo_rectangle_int_t crop; // of the decoded image, kept in data
+	unsigned char *data;
+	int stride;
+	convert_row_func convert_row;
+	int channels;
+};
+
+static void stream_size_prepared(GdkPixbufLoader *loader,
+		gint width, gint height, gpointer data) {
+	struct image_stream *stream = data;
+	stream->info->width = width;
+	stream->info->height = height;
+	int decode_width, decode_height;
+	get_decode_size(width, height, stream->targets, stream->count,
+			&decode_width, &decode_height);
+	if (decode_width < width || decode_height < height) {
+		// For JPEG this decodes at a fraction of the size right away
+		swaybg_log(LOG_DEBUG, "Decoding at %dx%d instead of %dx%d",
+				decode_width, decode_height, width, height);
+		gdk_pixbuf_loader_set_size(loader, decode_width, decode_height);
+	}
+}
+
+static void stream_area_prepared(GdkPixbufLoader *loader, gpointer data) {
+	struct image_stream *stream = data;
+	GdkPixbuf *pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+	int width = gdk_pixbuf_get_width(pixbuf);
+	int height = gdk_pixbuf_get_height(pixbuf);
+	stream->channels = gdk_pixbuf_get_n_channels(pixbuf);
+	if (stream->channels < 3) {
+		return;
+	}
+
+	struct background_image_info *info = stream->info;
+	info->crop_mode = BACKGROUND_MODE_INVALID;
+	stream->crop = (cairo_rectangle_int_t){ .width = width, .height = height };
+	if (width == info->width && height == info->height &&
+			get_crop(width, height, stream->targets, stream->count,
+				&info->crop_mode, &stream->crop)) {
+		swaybg_log(LOG_DEBUG, "Keeping %dx%d of %dx%d for %s mode",
+				stream->crop.width, stream->crop.height, width, height,
+				background_mode_name(info->crop_mode));
+	}
+
+	free(stream->data);
+	stream->stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32,
+			stream->crop.width);
+	stream->data = calloc(stream->crop.height, stream->stride);
+	stream->convert_row = stream->channels == 3 ?
+		get_rgb_row_converter() : get_rgba_row_converter();
+}
+
+static void stream_area_updated(GdkPixbufLoader *loader,
+		gint x, gint y, gint width, gint height, gpointer data) {
+	struct image_stream *stream = data;
+	if (!stream->data) {
+		return;
+	}
+	GdkPixbuf *pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+	const guint8 *pixels = gdk_pixbuf_read_pixels(pixbuf);
+	int rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+
+	int start = y > stream->crop.y ? y : stream->crop.y;
+	int end = y + height < stream->crop.y + stream->crop.height ?
+		y + height : stream->crop.y + stream->crop.height;
+	for (int row = start; row < end; ++row) {
+		stream->convert_row(pixels + (size_t)row * rowstride +
+				(size_t)stream->crop.x * stream->channels,
+				stream->data + (size_t)(row - stream->crop.y) * stream->stride,
+				stream->crop.width);
+	}
+}
+
+static bool stream_is_opaque(struct image_stream *stream) {
+	for (int y = 0; y < stream->crop.height; ++y) {
+		const uint32_t *row =
+			(const uint32_t *)(stream->data + (size_t)y * stream->stride);
+		for (int x = 0; x < stream->crop.width; ++x) {
+			if (row[x] >> 24 != 0xFF) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static const cairo_user_data_key_t stream_data_key;
+
+static cairo_surface_t *load_image_stream(FILE *file,
+		const struct background_target *targets, int count,
+		struct background_image_info *info) {
+	struct image_stream stream = {
+		.targets = targets,
+		.count = count,
+		.info = info,
+	};
+	GdkPixbufLoader *loader = gdk_pixbuf_loader_new();
+	g_signal_connect(loader, "size-prepared",
+			G_CALLBACK(stream_size_prepared), &stream);
+	g_signal_connect(loader, "area-prepared",
+			G_CALLBACK(stream_area_prepared), &stream);
+	g_signal_connect(loader, "area-updated",
+			G_CALLBACK(stream_area_updated), &stream);
+
 	GError *err = NULL;
-	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file(path, &err);
-	if (!pixbuf) {
+	guint8 *chunk = malloc(LOAD_CHUNK_SIZE);
+	bool ok = chunk;
+	size_t n;
+	while (ok && (n = fread(chunk, 1, LOAD_CHUNK_SIZE, file)) > 0) {
+		ok = gdk_pixbuf_loader_write(loader, chunk, n, &err);
+	}
+	ok = ok && !ferror(file);
+	free(chunk);
+	// Always closed, which also emits the last updates
+	if (!gdk_pixbuf_loader_close(loader, ok ? &err : NULL)) {
+		ok = false;
+	}
+	g_object_unref(loader);
+	if (!ok || !stream.data) {
 		swaybg_log(LOG_ERROR, "Failed to load background image (%s).",
-				err->message);
+				err ? err->message : "unsupported image");
+		if (err) {
+			g_error_free(err);
+		}
+		free(stream.data);
+		return NULL;
+	}
+
+	// Alpha channels that are fully opaque are common (e.g. PNG exports),
+	// keep those images opaque so that they can go into XRGB8888 buffers.
+	// Their premultiplied pixels are valid xRGB as they are.
+	bool opaque = stream.channels == 3 || stream_is_opaque(&stream);
+	cairo_surface_t *image = cairo_image_surface_create_for_data(stream.data,
+			opaque ? CAIRO_FORMAT_RGB24 : CAIRO_FORMAT_ARGB32,
+			stream.crop.width, stream.crop.height, stream.stride);
+	if (cairo_surface_status(image) != CAIRO_STATUS_SUCCESS ||
+			cairo_surface_set_user_data(image, &stream_data_key,
+				stream.data, free) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(image);
+		free(stream.data);
 		return NULL;
 	}
-	image = gdk_cairo_image_surface_create_from_pixbuf(pixbuf);
-	g_object_unref(pixbuf);
+	return image;
+}
 #else
-	image = cairo_image_surface_create_from_png(path);
+static cairo_status_t read_png(void *closure, unsigned char *data,
+		unsigned int length) {
+	return fread(data, 1, length, closure) == length ?
+		CAIRO_STATUS_SUCCESS : CAIRO_STATUS_READ_ERROR;
+}
 #endif // HAVE_GDK_PIXBUF
+
+cairo_surface_t *load_background_image(const char *path,
+		const struct background_target *targets, int count,
+		struct background_image_info *info) {
+	cairo_surface_t *image;
+	*info = (struct background_image_info){
+		.crop_mode = BACKGROUND_MODE_INVALID,
+	};
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		swaybg_log_errno(LOG_ERROR, "Failed to open background image %s",
+				path);
+		return NULL;
+	}
+	// Taken from the file that is actually read, so that it still describes
+	// the decoded contents if the file is replaced later on
+	struct stat st;
+	if (fstat(fileno(file), &st) == 0) {
+		info->mtime = st.st_mtim;
+		info->file_size = st.st_size;
+	}
+#if HAVE_GDK_PIXBUF
+	image = load_image_stream(file, targets, count, info);
+	fclose(file);
 	if (!image) {
-		swaybg_log(LOG_ERROR, "Failed to read background image.");
 		return NULL;
 	}
+#else
+	image = cairo_image_surface_create_from_png_stream(read_png, file);
+	fclose(file);
 	if (cairo_surface_status(image) != CAIRO_STATUS_SUCCESS) {
 		swaybg_log(LOG_ERROR, "Failed to read background image: %s."
-#if !HAVE_GDK_PIXBUF
 				"\nSway was compiled without gdk_pixbuf support, so only"
 				"\nPNG images can be loaded. This is the likely cause."
-#endif // !HAVE_GDK_PIXBUF
 				, cairo_status_to_string(cairo_surface_status(image)));
+		cairo_surface_destroy(image);
 		return NULL;
 	}
+	info->width = cairo_image_surface_get_width(image);
+	info->height = cairo_image_surface_get_height(image);
+
+	// Cairo always decodes at full size, so shrink the image right away to
+	// what the targets need. Deep PNGs come in float formats, which are kept.
+	cairo_format_t format = cairo_image_surface_get_format(image);
+	int width, height;
+	get_decode_size(info->width, info->height, targets, count,
+			&width, &height);
+	if ((width < info->width || height < info->height) &&
+			(format == CAIRO_FORMAT_ARGB32 || format == CAIRO_FORMAT_RGB24)) {
+		swaybg_log(LOG_DEBUG, "Scaling %dx%d down to %dx%d",
+				info->width, info->height, width, height);
+		cairo_surface_t *scaled =
+			cairo_image_surface_scale(image, width, height);
+		if (scaled) {
+			cairo_surface_destroy(image);
+			image = scaled;
+		}
+	}
+#endif // HAVE_GDK_PIXBUF
 	return image;
 }
 
@@ -64,6 +443,8 @@ void render_background_image(cairo_t *cairo, cairo_surface_t *image,
 				(double)buffer_width / width,
 				(double)buffer_height / height);
 		cairo_set_source_surface(cairo, image, 0, 0);
+		// Keep the edges from fading out, the image covers the buffer
+		cairo_pattern_set_extend(cairo_get_source(cairo), CAIRO_EXTEND_PAD);
 		break;
 	case BACKGROUND_MODE_FILL: {
 		double window_ratio = (double)buffer_width / buffer_height;
@@ -80,6 +461,7 @@ void render_background_image(cairo_t *cairo, cairo_surface_t *image,
 			cairo_set_source_surface(cairo, image,
 					(double)buffer_width / 2 / scale - width / 2, 0);
 		}
+		cairo_pattern_set_extend(cairo_get_source(cairo), CAIRO_EXTEND_PAD);
 		break;
 	}
 	case BACKGROUND_MODE_FIT: {
@@ -108,6 +490,7 @@ void render_background_image(cairo_t *cairo, cairo_surface_t *image,
 		cairo_pattern_t *pattern = cairo_pattern_create_for_surface(image);
 		cairo_pattern_set_extend(pattern, CAIRO_EXTEND_REPEAT);
 		cairo_set_source(cairo, pattern);
+		cairo_pattern_destroy(pattern);
 		break;
 	}
 	case BACKGROUND_MODE_SOLID_COLOR:
@@ -118,3 +501,17 @@ void render_background_image(cairo_t *cairo, cairo_surface_t *image,
 	cairo_paint(cairo);
 	cairo_restore(cairo);
 }
+
+bool background_is_opaque(cairo_surface_t *image, enum background_mode mode,
+		uint32_t color) {
+	if ((color & 0xFF) == 0xFF) {
+		return true;
+	}
+	if (mode == BACKGROUND_MODE_SOLID_COLOR || !image ||
+			cairo_surface_get_content(image) != CAIRO_CONTENT_COLOR) {
+		return false;
+	}
+	// Modes that leave part of the buffer uncovered show the color there
+	return mode == BACKGROUND_MODE_STRETCH || mode == BACKGROUND_MODE_FILL ||
+		mode == BACKGROUND_MODE_TILE;
+}
@@ -1,9 +1,10 @@
+#include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include <cairo.h>
 #include "cairo_util.h"
-#if HAVE_GDK_PIXBUF
-#include <gdk-pixbuf/gdk-pixbuf.h>
-#endif
+#include "image-scale.h"
 
 void cairo_set_source_u32(cairo_t *cairo, uint32_t color) {
 	cairo_set_source_rgba(cairo,
@@ -29,98 +30,184 @@ cairo_subpixel_order_t to_cairo_subpixel_order(enum wl_output_subpixel subpixel)
 	return CAIRO_SUBPIXEL_ORDER_DEFAULT;
 }
 
-#if HAVE_GDK_PIXBUF
-cairo_surface_t* gdk_cairo_image_surface_create_from_pixbuf(const GdkPixbuf *gdkbuf) {
-	int chan = gdk_pixbuf_get_n_channels(gdkbuf);
-	if (chan < 3) {
+cairo_surface_t *cairo_image_surface_scale(cairo_surface_t *image,
+		int width, int height) {
+	int image_width = cairo_image_surface_get_width(image);
+	int image_height = cairo_image_surface_get_height(image);
+
+	cairo_surface_t *new = cairo_image_surface_create(
+			cairo_image_surface_get_format(image), width, height);
+	if (cairo_surface_status(new) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(new);
 		return NULL;
 	}
-
-	const guint8* gdkpix = gdk_pixbuf_read_pixels(gdkbuf);
-	if (!gdkpix) {
+	cairo_surface_flush(image);
+	cairo_surface_flush(new);
+	if (!scale_pixels(cairo_image_surface_get_data(image),
+			image_width, image_height, cairo_image_surface_get_stride(image),
+			cairo_image_surface_get_data(new), width, height,
+			cairo_image_surface_get_stride(new),
+			scale_filter_for_sizes(image_width, width),
+			scale_filter_for_sizes(image_height, height), 0, height)) {
+		cairo_surface_destroy(new);
 		return NULL;
 	}
-	gint w = gdk_pixbuf_get_width(gdkbuf);
-	gint h = gdk_pixbuf_get_height(gdkbuf);
-	int stride = gdk_pixbuf_get_rowstride(gdkbuf);
+	cairo_surface_mark_dirty(new);
+	return new;
+}
 
-	cairo_format_t fmt = (chan == 3) ? CAIRO_FORMAT_RGB24 : CAIRO_FORMAT_ARGB32;
-	cairo_surface_t * cs = cairo_image_surface_create (fmt, w, h);
-	cairo_surface_flush (cs);
-	if ( !cs || cairo_surface_status(cs) != CAIRO_STATUS_SUCCESS) {
-		return NULL;
+void cairo_image_surface_copy(cairo_surface_t *dest, cairo_surface_t *src) {
+	cairo_rectangle_int_t rect = {
+		.width = cairo_image_surface_get_width(src),
+		.height = cairo_image_surface_get_height(src),
+	};
+	cairo_image_surface_copy_rect(dest, src, &rect);
+}
+
+void cairo_image_surface_copy_rect(cairo_surface_t *dest,
+		cairo_surface_t *src, const cairo_rectangle_int_t *rect) {
+	int width = cairo_image_surface_get_width(src);
+	int height = cairo_image_surface_get_height(src);
+	assert(cairo_image_surface_get_width(dest) == width &&
+			cairo_image_surface_get_height(dest) == height);
+	assert(rect->x >= 0 && rect->y >= 0 &&
+			rect->x + rect->width <= width && rect->y + rect->height <= height);
+
+	cairo_surface_flush(src);
+	cairo_surface_flush(dest);
+	int src_stride = cairo_image_surface_get_stride(src);
+	int dest_stride = cairo_image_surface_get_stride(dest);
+	const unsigned char *sp = cairo_image_surface_get_data(src) +
+		(size_t)rect->y * src_stride + (size_t)rect->x * 4;
+	unsigned char *dp = cairo_image_surface_get_data(dest) +
+		(size_t)rect->y * dest_stride + (size_t)rect->x * 4;
+	if (src_stride == dest_stride && rect->x == 0 && rect->width == width) {
+		memcpy(dp, sp, (size_t)src_stride * rect->height);
+	} else {
+		for (int y = 0; y < rect->height; ++y) {
+			memcpy(dp, sp, (size_t)rect->width * 4);
+			sp += src_stride;
+			dp += dest_stride;
+		}
 	}
+	cairo_surface_mark_dirty_rectangle(dest,
+			rect->x, rect->y, rect->width, rect->height);
+}
 
-	int cstride = cairo_image_surface_get_stride(cs);
-	unsigned char * cpix = cairo_image_surface_get_data(cs);
+void cairo_image_surface_repeat(cairo_surface_t *surface,
+		int tile_width, int tile_height) {
+	int width = cairo_image_surface_get_width(surface);
+	int height = cairo_image_surface_get_height(surface);
+	assert(tile_width > 0 && tile_height > 0 &&
+			tile_width <= width && tile_height <= height);
 
-	if (chan == 3) {
-		int i;
-		for (i = h; i; --i) {
-			const guint8 *gp = gdkpix;
-			unsigned char *cp = cpix;
-			const guint8* end = gp + 3*w;
-			while (gp < end) {
-#if G_BYTE_ORDER == G_LITTLE_ENDIAN
-				cp[0] = gp[2];
-				cp[1] = gp[1];
-				cp[2] = gp[0];
-#else
-				cp[1] = gp[0];
-				cp[2] = gp[1];
-				cp[3] = gp[2];
-#endif
-				gp += 3;
-				cp += 4;
-			}
-			gdkpix += stride;
-			cpix += cstride;
+	cairo_surface_flush(surface);
+	int stride = cairo_image_surface_get_stride(surface);
+	unsigned char *data = cairo_image_surface_get_data(surface);
+	// Every copy doubles what is done, so that even small tiles fill the
+	// surface with few large copies
+	size_t row_size = (size_t)width * 4;
+	for (int y = 0; y < tile_height; ++y) {
+		unsigned char *row = data + (size_t)y * stride;
+		for (size_t done = (size_t)tile_width * 4; done < row_size; ) {
+			size_t n = done < row_size - done ? done : row_size - done;
+			memcpy(row + done, row, n);
+			done += n;
 		}
-	} else {
-		/* premul-color = alpha/255 * color/255 * 255 = (alpha*color)/255
-		 * (z/255) = z/256 * 256/255     = z/256 (1 + 1/255)
-		 *         = z/256 + (z/256)/255 = (z + z/255)/256
-		 *         # recurse once
-		 *         = (z + (z + z/255)/256)/256
-		 *         = (z + z/256 + z/256/255) / 256
-		 *         # only use 16bit uint operations, loose some precision,
-		 *         # result is floored.
-		 *       ->  (z + z>>8)>>8
-		 *         # add 0x80/255 = 0.5 to convert floor to round
-		 *       =>  (z+0x80 + (z+0x80)>>8 ) >> 8
-		 * ------
-		 * tested as equal to lround(z/255.0) for uint z in [0..0xfe02]
-		 */
-#define PREMUL_ALPHA(x,a,b,z) \
-		G_STMT_START { z = a * b + 0x80; x = (z + (z >> 8)) >> 8; } \
-		G_STMT_END
-		int i;
-		for (i = h; i; --i) {
-			const guint8 *gp = gdkpix;
-			unsigned char *cp = cpix;
-			const guint8* end = gp + 4*w;
-			guint z1, z2, z3;
-			while (gp < end) {
-#if G_BYTE_ORDER == G_LITTLE_ENDIAN
-				PREMUL_ALPHA(cp[0], gp[2], gp[3], z1);
-				PREMUL_ALPHA(cp[1], gp[1], gp[3], z2);
-				PREMUL_ALPHA(cp[2], gp[0], gp[3], z3);
-				cp[3] = gp[3];
-#else
-				PREMUL_ALPHA(cp[1], gp[0], gp[3], z1);
-				PREMUL_ALPHA(cp[2], gp[1], gp[3], z2);
-				PREMUL_ALPHA(cp[3], gp[2], gp[3], z3);
-				cp[0] = gp[3];
-#endif
-				gp += 4;
-				cp += 4;
+	}
+	for (int done = tile_height; done < height; ) {
+		int n = done < height - done ? done : height - done;
+		memcpy(data + (size_t)done * stride, data, (size_t)n * stride);
+		done += n;
+	}
+	cairo_surface_mark_dirty(surface);
+}
+
+static bool tile_differs(const unsigned char *a, int a_stride,
+		const unsigned char *b, int b_stride, int width, int height) {
+	for (int y = 0; y < height; ++y) {
+		if (memcmp(a, b, (size_t)width * 4) != 0) {
+			return true;
+		}
+		a += a_stride;
+		b += b_stride;
+	}
+	return false;
+}
+
+int cairo_image_surface_diff(cairo_surface_t *a, cairo_surface_t *b,
+		int tile_size, cairo_rectangle_int_t *rects, int max_rects) {
+	int width = cairo_image_surface_get_width(a);
+	int height = cairo_image_surface_get_height(a);
+	assert(cairo_image_surface_get_width(b) == width &&
+			cairo_image_surface_get_height(b) == height);
+
+	cairo_surface_flush(a);
+	cairo_surface_flush(b);
+	const unsigned char *a_data = cairo_image_surface_get_data(a);
+	const unsigned char *b_data = cairo_image_surface_get_data(b);
+	int a_stride = cairo_image_surface_get_stride(a);
+	int b_stride = cairo_image_surface_get_stride(b);
+
+	int count = 0;
+	bool overflow = false;
+	cairo_rectangle_int_t bounds = {0};
+	for (int ty = 0; ty < height; ty += tile_size) {
+		int th = height - ty < tile_size ? height - ty : tile_size;
+		int run = -1; // x where the current run of differing tiles starts
+		for (int tx = 0; ; tx += tile_size) {
+			int tw = width - tx < tile_size ? width - tx : tile_size;
+			bool differs = tx < width && tile_differs(
+					a_data + (size_t)ty * a_stride + (size_t)tx * 4, a_stride,
+					b_data + (size_t)ty * b_stride + (size_t)tx * 4, b_stride,
+					tw, th);
+			if (differs && run == -1) {
+				run = tx;
+			} else if (!differs && run != -1) {
+				cairo_rectangle_int_t span = {
+					.x = run, .y = ty,
+					.width = (tx < width ? tx : width) - run, .height = th,
+				};
+				run = -1;
+
+				if (count == 0 && !overflow) {
+					bounds = span;
+				} else {
+					int x2 = bounds.x + bounds.width > span.x + span.width ?
+						bounds.x + bounds.width : span.x + span.width;
+					bounds.x = bounds.x < span.x ? bounds.x : span.x;
+					bounds.width = x2 - bounds.x;
+					bounds.height = span.y + span.height - bounds.y;
+				}
+				if (overflow) {
+					continue;
+				}
+				// Grow a rectangle ending right above if it has the same span
+				bool merged = false;
+				for (int i = 0; i < count; ++i) {
+					if (rects[i].x == span.x && rects[i].width == span.width &&
+							rects[i].y + rects[i].height == span.y) {
+						rects[i].height += span.height;
+						merged = true;
+						break;
+					}
+				}
+				if (!merged) {
+					if (count == max_rects) {
+						overflow = true;
+					} else {
+						rects[count++] = span;
+					}
+				}
+			}
+			if (tx >= width) {
+				break;
 			}
-			gdkpix += stride;
-			cpix += cstride;
 		}
-#undef PREMUL_ALPHA
 	}
-	cairo_surface_mark_dirty(cs);
-	return cs;
+	if (overflow) {
+		rects[0] = bounds;
+		return 1;
+	}
+	return count;
 }
-#endif // HAVE_GDK_PIXBUF
@@ -0,0 +1,189 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <cairo.h>
+#include "background-image.h"
+#include "cairo_util.h"
+#include "compose.h"
+#include "image-scale.h"
+#include "perf.h"
+#include "worker.h"
+
+/*
+ * Frames are split into bands of at least this many rows, which are scaled
+ * in parallel on the worker threads.
+ */
+#define MIN_BAND_HEIGHT 64
+
+struct render_band_data {
+	enum background_mode mode;
+	uint32_t color;
+	cairo_surface_t *image;
+	cairo_surface_t *target;
+	int width, height, band_height;
+};
+
+static void render_band(void *data, int index) {
+	struct render_band_data *band = data;
+	int y = index * band->band_height;
+	int height = band->height - y < band->band_height ?
+		band->height - y : band->band_height;
+
+	// Cairo surfaces must not be shared between threads, so every band
+	// wraps the pixels of the source image and the target in its own
+	int stride = cairo_image_surface_get_stride(band->target);
+	cairo_surface_t *target = cairo_image_surface_create_for_data(
+			cairo_image_surface_get_data(band->target) + (size_t)y * stride,
+			cairo_image_surface_get_format(band->target),
+			band->width, height, stride);
+	cairo_surface_t *image = cairo_image_surface_create_for_data(
+			cairo_image_surface_get_data(band->image),
+			cairo_image_surface_get_format(band->image),
+			cairo_image_surface_get_width(band->image),
+			cairo_image_surface_get_height(band->image),
+			cairo_image_surface_get_stride(band->image));
+
+	cairo_t *cairo = cairo_create(target);
+	cairo_translate(cairo, 0, -y);
+	if (band->color) {
+		cairo_set_source_u32(cairo, band->color);
+		cairo_paint(cairo);
+	}
+	render_background_image(cairo, image, band->mode,
+			band->width, band->height);
+	cairo_destroy(cairo);
+	cairo_surface_destroy(image);
+	cairo_surface_destroy(target);
+}
+
+struct scale_band_data {
+	cairo_surface_t *image;
+	cairo_surface_t *target;
+	int band_height;
+	bool *failed; // one per band
+};
+
+static void scale_band(void *data, int index) {
+	struct scale_band_data *band = data;
+	int width = cairo_image_surface_get_width(band->image);
+	int height = cairo_image_surface_get_height(band->image);
+	int target_width = cairo_image_surface_get_width(band->target);
+	int target_height = cairo_image_surface_get_height(band->target);
+	int y = index * band->band_height;
+	int rows = target_height - y < band->band_height ?
+		target_height - y : band->band_height;
+	bool ok = scale_pixels(cairo_image_surface_get_data(band->image),
+			width, height, cairo_image_surface_get_stride(band->image),
+			cairo_image_surface_get_data(band->target),
+			target_width, target_height,
+			cairo_image_surface_get_stride(band->target),
+			scale_filter_for_sizes(width, target_width),
+			scale_filter_for_sizes(height, target_height), y, rows);
+	band->failed[index] = !ok;
+}
+
+cairo_surface_t *downscale_image(struct worker_pool *workers,
+		cairo_surface_t *image, int width, int height) {
+	int64_t start = perf_start();
+	cairo_surface_t *surface = cairo_image_surface_create(
+			cairo_image_surface_get_format(image), width, height);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
+		return NULL;
+	}
+	int bands = 2 * (worker_pool_get_thread_count(workers) + 1);
+	struct scale_band_data band = {
+		.image = image,
+		.target = surface,
+		.band_height = (height + bands - 1) / bands,
+	};
+	if (band.band_height < MIN_BAND_HEIGHT) {
+		band.band_height = MIN_BAND_HEIGHT;
+	}
+	bands = (height + band.band_height - 1) / band.band_height;
+	band.failed = calloc(bands, sizeof(bool));
+	if (!band.failed) {
+		cairo_surface_destroy(surface);
+		return NULL;
+	}
+	cairo_surface_flush(surface);
+	worker_pool_run_bands(workers, scale_band, &band, bands);
+	cairo_surface_mark_dirty(surface);
+	for (int i = 0; i < bands; ++i) {
+		if (band.failed[i]) {
+			cairo_surface_destroy(surface);
+			surface = NULL;
+			break;
+		}
+	}
+	free(band.failed);
+	perf_record("downscale", start, (int64_t)width * height,
+			"\"src_width\":%d,\"src_height\":%d,"
+			"\"width\":%d,\"height\":%d",
+			cairo_image_surface_get_width(image),
+			cairo_image_surface_get_height(image), width, height);
+	return surface;
+}
+
+cairo_surface_t *compose_background(struct worker_pool *workers,
+		cairo_surface_t *image, enum background_mode mode, uint32_t color,
+		int width, int height) {
+	int64_t start = perf_start();
+	int image_width = cairo_image_surface_get_width(image);
+	int image_height = cairo_image_surface_get_height(image);
+	// Opaque frames are stored as RGB24, which tells render_shared_frame to
+	// use an XRGB8888 buffer for them
+	cairo_format_t format = background_is_opaque(image, mode, color) ?
+		CAIRO_FORMAT_RGB24 : CAIRO_FORMAT_ARGB32;
+	cairo_surface_t *surface =
+		cairo_image_surface_create(format, width, height);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
+		return NULL;
+	}
+
+	int scaled_width, scaled_height;
+	cairo_surface_t *scaled = NULL;
+	if (background_image_scaled_size(image_width, image_height,
+			mode, width, height, &scaled_width, &scaled_height)) {
+		// Falls back to letting cairo scale it
+		scaled = downscale_image(workers, image, scaled_width, scaled_height);
+		if (scaled) {
+			image = scaled;
+		}
+	}
+
+	struct render_band_data band = {
+		.mode = mode,
+		.color = color,
+		.image = image,
+		.target = surface,
+		.width = width,
+		.height = height,
+	};
+	cairo_surface_flush(surface);
+	if (mode == BACKGROUND_MODE_TILE) {
+		// Only the first tile is drawn, the others are copies of it, which
+		// is much cheaper than sampling the pattern for every pixel
+		band.width = image_width < width ? image_width : width;
+		band.height = band.band_height =
+			image_height < height ? image_height : height;
+		render_band(&band, 0);
+		cairo_surface_mark_dirty(surface);
+		cairo_image_surface_repeat(surface, band.width, band.height);
+	} else {
+		int bands = 2 * (worker_pool_get_thread_count(workers) + 1);
+		band.band_height = (height + bands - 1) / bands;
+		if (band.band_height < MIN_BAND_HEIGHT) {
+			band.band_height = MIN_BAND_HEIGHT;
+		}
+		worker_pool_run_bands(workers, render_band, &band,
+				(height + band.band_height - 1) / band.band_height);
+		cairo_surface_mark_dirty(surface);
+	}
+	cairo_surface_destroy(scaled);
+	perf_record("scale", start, (int64_t)width * height,
+			"\"mode\":\"%s\",\"src_width\":%d,\"src_height\":%d,"
+			"\"width\":%d,\"height\":%d", background_mode_name(mode),
+			image_width, image_height, width, height);
+	return surface;
+}
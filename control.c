@@ -0,0 +1,251 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include "control.h"
+#include "log.h"
+#include "loop.h"
+
+#define CONTROL_LINE_MAX 4096
+
+struct control_client {
+	struct control_server *server;
+	int fd;
+	char buf[CONTROL_LINE_MAX];
+	size_t len;
+	struct wl_list link; // struct control_server::clients
+};
+
+struct control_server {
+	struct loop *loop;
+	struct control_handler handler;
+	char *path;
+	int fd;
+	struct wl_list clients; // struct control_client::link
+};
+
+static bool set_nonblock_cloexec(int fd) {
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		return false;
+	}
+	flags = fcntl(fd, F_GETFD);
+	if (flags == -1 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1) {
+		return false;
+	}
+	return true;
+}
+
+static void destroy_client(struct control_client *client) {
+	loop_remove_fd(client->server->loop, client->fd);
+	close(client->fd);
+	wl_list_remove(&client->link);
+	free(client);
+}
+
+void control_client_reply(struct control_client *client,
+		const char *fmt, ...) {
+	char reply[CONTROL_LINE_MAX];
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(reply, sizeof(reply) - 1, fmt, args);
+	va_end(args);
+	if (len < 0) {
+		return;
+	}
+	if ((size_t)len > sizeof(reply) - 2) {
+		len = sizeof(reply) - 2;
+	}
+	reply[len++] = '\n';
+	// Replies are short; a client that does not read them loses them
+	if (send(client->fd, reply, len, MSG_NOSIGNAL) == -1 && errno != EAGAIN) {
+		swaybg_log_errno(LOG_DEBUG, "Failed to reply to control client");
+	}
+}
+
+static void client_in(int fd, short mask, void *data) {
+	struct control_client *client = data;
+	struct control_server *server = client->server;
+
+	ssize_t n = read(fd, client->buf + client->len,
+			sizeof(client->buf) - client->len);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+		return;
+	}
+	if (n <= 0) {
+		destroy_client(client);
+		return;
+	}
+	client->len += n;
+
+	bool handled = false;
+	char *line = client->buf;
+	char *end;
+	while ((end = memchr(line, '\n', client->len - (line - client->buf)))) {
+		*end = '\0';
+		if (end > line && end[-1] == '\r') {
+			end[-1] = '\0';
+		}
+		server->handler.command(server->handler.data, client, line);
+		handled = true;
+		line = end + 1;
+	}
+	client->len -= line - client->buf;
+	memmove(client->buf, line, client->len);
+
+	if (handled && server->handler.batch_done) {
+		server->handler.batch_done(server->handler.data);
+	}
+	if (client->len == sizeof(client->buf)) {
+		control_client_reply(client, "error: command too long");
+		destroy_client(client);
+	}
+}
+
+static void server_in(int fd, short mask, void *data) {
+	struct control_server *server = data;
+	while (true) {
+		int client_fd = accept(fd, NULL, NULL);
+		if (client_fd == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				swaybg_log_errno(LOG_ERROR, "Failed to accept control client");
+			}
+			return;
+		}
+		struct control_client *client = calloc(1,
+				sizeof(struct control_client));
+		if (!client || !set_nonblock_cloexec(client_fd) ||
+				!loop_add_fd(server->loop, client_fd, POLLIN,
+					client_in, client)) {
+			swaybg_log(LOG_ERROR, "Failed to set up control client");
+			free(client);
+			close(client_fd);
+			continue;
+		}
+		client->server = server;
+		client->fd = client_fd;
+		wl_list_insert(&server->clients, &client->link);
+	}
+}
+
+/*
+ * A previous instance may have left its socket behind. It is only removed if
+ * it is a socket and nothing accepts connections on it anymore, so that
+ * neither an unrelated file nor a running instance's socket is taken over.
+ */
+static bool remove_stale_socket(const struct sockaddr_un *addr) {
+	struct stat st;
+	if (lstat(addr->sun_path, &st) == -1) {
+		if (errno == ENOENT) {
+			return true;
+		}
+		swaybg_log_errno(LOG_ERROR, "Failed to stat %s", addr->sun_path);
+		return false;
+	}
+	if (!S_ISSOCK(st.st_mode)) {
+		swaybg_log(LOG_ERROR, "%s exists and is not a socket",
+				addr->sun_path);
+		return false;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		swaybg_log_errno(LOG_ERROR, "Failed to create socket");
+		return false;
+	}
+	int ret = connect(fd, (const struct sockaddr *)addr, sizeof(*addr));
+	int err = errno;
+	close(fd);
+	if (ret == 0) {
+		swaybg_log(LOG_ERROR, "Another instance is listening on %s",
+				addr->sun_path);
+		return false;
+	}
+	if (err != ECONNREFUSED) {
+		errno = err;
+		swaybg_log_errno(LOG_ERROR, "Failed to connect to %s",
+				addr->sun_path);
+		return false;
+	}
+	if (unlink(addr->sun_path) == -1 && errno != ENOENT) {
+		swaybg_log_errno(LOG_ERROR, "Failed to remove stale socket %s",
+				addr->sun_path);
+		return false;
+	}
+	return true;
+}
+
+struct control_server *control_server_create(struct loop *loop,
+		const char *path, const struct control_handler *handler) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		swaybg_log(LOG_ERROR, "Control socket path is too long: %s", path);
+		return NULL;
+	}
+	strcpy(addr.sun_path, path);
+
+	struct control_server *server = calloc(1, sizeof(struct control_server));
+	if (!server) {
+		swaybg_log(LOG_ERROR, "Failed to allocate control server");
+		return NULL;
+	}
+	server->loop = loop;
+	server->handler = *handler;
+	wl_list_init(&server->clients);
+
+	server->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server->fd == -1 || !set_nonblock_cloexec(server->fd)) {
+		swaybg_log_errno(LOG_ERROR, "Failed to create control socket");
+		goto error;
+	}
+	if (!remove_stale_socket(&addr)) {
+		goto error;
+	}
+	if (bind(server->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		swaybg_log_errno(LOG_ERROR, "Failed to bind control socket %s", path);
+		goto error;
+	}
+	server->path = strdup(path);
+	if (listen(server->fd, 4) == -1 ||
+			!loop_add_fd(loop, server->fd, POLLIN, server_in, server)) {
+		swaybg_log_errno(LOG_ERROR, "Failed to listen on control socket");
+		goto error;
+	}
+	swaybg_log(LOG_DEBUG, "Listening for commands on %s", path);
+	return server;
+
+error:
+	if (server->fd != -1) {
+		close(server->fd);
+	}
+	if (server->path) {
+		unlink(server->path);
+		free(server->path);
+	}
+	free(server);
+	return NULL;
+}
+
+void control_server_destroy(struct control_server *server) {
+	if (!server) {
+		return;
+	}
+	struct control_client *client, *tmp;
+	wl_list_for_each_safe(client, tmp, &server->clients, link) {
+		destroy_client(client);
+	}
+	loop_remove_fd(server->loop, server->fd);
+	close(server->fd);
+	unlink(server->path);
+	free(server->path);
+	free(server);
+}
@@ -0,0 +1,376 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "image-cache.h"
+#include "log.h"
+
+// Bump when the file layout or the way images are composed changes
+#define IMAGE_CACHE_VERSION 1
+#define IMAGE_CACHE_MAX_SIZE (256 << 20)
+#define IMAGE_CACHE_SUFFIX ".bg"
+// Entries are written to "<hash>.XXXXXX" first. Ones older than this were
+// left behind by a crash or a failed write, not by a store in progress.
+#define IMAGE_CACHE_STALE_TEMP_SECS 3600
+
+static const char image_cache_magic[8] = "swaybg\0\0";
+
+// Followed by height rows of width * 4 bytes, at HEADER_SIZE
+struct image_cache_header {
+	char magic[8];
+	uint64_t key;
+	uint32_t width, height;
+	uint32_t format; // cairo_format_t
+};
+
+#define HEADER_SIZE 64
+
+static char *cache_dir = NULL;
+
+static bool make_dir(const char *path) {
+	if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+		swaybg_log_errno(LOG_DEBUG, "Failed to create %s", path);
+		return false;
+	}
+	return true;
+}
+
+bool image_cache_init(void) {
+	const char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	char base[4096];
+	if (xdg_cache_home && *xdg_cache_home) {
+		snprintf(base, sizeof(base), "%s", xdg_cache_home);
+	} else if (home && *home) {
+		snprintf(base, sizeof(base), "%s/.cache", home);
+		if (!make_dir(base)) {
+			return false;
+		}
+	} else {
+		return false;
+	}
+
+	size_t len = strlen(base) + strlen("/swaybg") + 1;
+	cache_dir = malloc(len);
+	if (!cache_dir) {
+		return false;
+	}
+	snprintf(cache_dir, len, "%s/swaybg", base);
+	if (!make_dir(cache_dir)) {
+		free(cache_dir);
+		cache_dir = NULL;
+		return false;
+	}
+	swaybg_log(LOG_DEBUG, "Caching scaled images in %s", cache_dir);
+	return true;
+}
+
+void image_cache_finish(void) {
+	free(cache_dir);
+	cache_dir = NULL;
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+	// FNV-1a
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+bool image_cache_stat_source(struct image_cache_key *key) {
+	struct stat st;
+	if (stat(key->path, &st) == -1) {
+		return false;
+	}
+	key->mtime = st.st_mtim;
+	key->file_size = st.st_size;
+	return true;
+}
+
+static uint64_t hash_key(const struct image_cache_key *key) {
+	struct {
+		int64_t mtime_sec, mtime_nsec, size;
+		int32_t width, height, mode, version;
+		uint32_t color;
+	} fields;
+	// Padding would otherwise make the hash differ between runs
+	memset(&fields, 0, sizeof(fields));
+	fields.mtime_sec = key->mtime.tv_sec;
+	fields.mtime_nsec = key->mtime.tv_nsec;
+	fields.size = key->file_size;
+	fields.width = key->width;
+	fields.height = key->height;
+	fields.mode = key->mode;
+	fields.version = IMAGE_CACHE_VERSION;
+	fields.color = key->color;
+	uint64_t hash = hash_bytes(0xcbf29ce484222325,
+			key->path, strlen(key->path) + 1);
+	return hash_bytes(hash, &fields, sizeof(fields));
+}
+
+static char *entry_path(uint64_t hash, const char *suffix) {
+	size_t len = strlen(cache_dir) + 1 + 16 + strlen(suffix) + 1;
+	char *path = malloc(len);
+	if (path) {
+		snprintf(path, len, "%s/%016llx%s", cache_dir,
+				(unsigned long long)hash, suffix);
+	}
+	return path;
+}
+
+struct image_cache_mapping {
+	void *data;
+	size_t size;
+};
+
+static const cairo_user_data_key_t mapping_key;
+
+static void unmap_entry(void *data) {
+	struct image_cache_mapping *mapping = data;
+	munmap(mapping->data, mapping->size);
+	free(mapping);
+}
+
+cairo_surface_t *image_cache_load(const struct image_cache_key *key) {
+	if (!cache_dir) {
+		return NULL;
+	}
+	uint64_t hash = hash_key(key);
+	char *path = entry_path(hash, IMAGE_CACHE_SUFFIX);
+	if (!path) {
+		return NULL;
+	}
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if (fd == -1) {
+		return NULL;
+	}
+
+	cairo_surface_t *surface = NULL;
+	struct image_cache_mapping *mapping = NULL;
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size < HEADER_SIZE) {
+		goto out;
+	}
+	// Private and writable so that cairo may treat it as any other surface,
+	// pages are only copied if something actually draws to it
+	void *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		goto out;
+	}
+	mapping = calloc(1, sizeof(struct image_cache_mapping));
+	if (!mapping) {
+		munmap(data, st.st_size);
+		goto out;
+	}
+	mapping->data = data;
+	mapping->size = st.st_size;
+
+	const struct image_cache_header *header = data;
+	if (memcmp(header->magic, image_cache_magic, sizeof(header->magic)) != 0 ||
+			header->key != hash ||
+			(int)header->width != key->width ||
+			(int)header->height != key->height ||
+			(header->format != CAIRO_FORMAT_ARGB32 &&
+			 header->format != CAIRO_FORMAT_RGB24) ||
+			(size_t)st.st_size != HEADER_SIZE +
+				(size_t)header->width * 4 * header->height) {
+		swaybg_log(LOG_DEBUG, "Ignoring invalid cache entry for %s",
+				key->path);
+		goto out;
+	}
+
+	surface = cairo_image_surface_create_for_data(
+			(unsigned char *)data + HEADER_SIZE, header->format,
+			header->width, header->height, header->width * 4);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ||
+			cairo_surface_set_user_data(surface, &mapping_key, mapping,
+				unmap_entry) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
+		surface = NULL;
+		goto out;
+	}
+	mapping = NULL;
+	// The modification time of entries tracks their last use
+	futimens(fd, NULL);
+	swaybg_log(LOG_DEBUG, "Using cached %dx%d image for %s",
+			key->width, key->height, key->path);
+
+out:
+	if (mapping) {
+		unmap_entry(mapping);
+	}
+	close(fd);
+	return surface;
+}
+
+struct cache_entry {
+	char *name;
+	off_t size;
+	struct timespec used;
+};
+
+static int compare_entries(const void *a, const void *b) {
+	const struct cache_entry *ea = a, *eb = b;
+	if (ea->used.tv_sec != eb->used.tv_sec) {
+		return ea->used.tv_sec < eb->used.tv_sec ? -1 : 1;
+	}
+	if (ea->used.tv_nsec != eb->used.tv_nsec) {
+		return ea->used.tv_nsec < eb->used.tv_nsec ? -1 : 1;
+	}
+	return 0;
+}
+
+static bool is_temp_entry(const char *name) {
+	size_t len = strlen(name);
+	return len == 16 + strlen(".XXXXXX") && name[16] == '.' &&
+		strspn(name, "0123456789abcdef") == 16;
+}
+
+static void evict_entries(void) {
+	DIR *dir = opendir(cache_dir);
+	if (!dir) {
+		return;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	struct cache_entry *entries = NULL;
+	size_t count = 0, capacity = 0;
+	off_t total = 0;
+	struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		size_t len = strlen(ent->d_name);
+		size_t suffix_len = strlen(IMAGE_CACHE_SUFFIX);
+		struct stat st;
+		if (is_temp_entry(ent->d_name)) {
+			if (fstatat(dirfd(dir), ent->d_name, &st, 0) == 0 &&
+					now.tv_sec - st.st_mtim.tv_sec >
+						IMAGE_CACHE_STALE_TEMP_SECS) {
+				swaybg_log(LOG_DEBUG, "Removing stale cache file %s",
+						ent->d_name);
+				unlinkat(dirfd(dir), ent->d_name, 0);
+			}
+			continue;
+		}
+		if (len <= suffix_len || strcmp(ent->d_name + len - suffix_len,
+					IMAGE_CACHE_SUFFIX) != 0 ||
+				fstatat(dirfd(dir), ent->d_name, &st, 0) == -1) {
+			continue;
+		}
+		if (count == capacity) {
+			size_t new_capacity = capacity ? capacity * 2 : 32;
+			struct cache_entry *new_entries = realloc(entries,
+					new_capacity * sizeof(struct cache_entry));
+			if (!new_entries) {
+				break;
+			}
+			entries = new_entries;
+			capacity = new_capacity;
+		}
+		entries[count].name = strdup(ent->d_name);
+		if (!entries[count].name) {
+			break;
+		}
+		entries[count].size = st.st_size;
+		entries[count].used = st.st_mtim;
+		total += st.st_size;
+		++count;
+	}
+
+	if (total > IMAGE_CACHE_MAX_SIZE) {
+		qsort(entries, count, sizeof(struct cache_entry), compare_entries);
+		for (size_t i = 0; i < count && total > IMAGE_CACHE_MAX_SIZE; ++i) {
+			// Another instance may have evicted it already
+			if (unlinkat(dirfd(dir), entries[i].name, 0) == 0 ||
+					errno == ENOENT) {
+				total -= entries[i].size;
+			}
+		}
+	}
+	for (size_t i = 0; i < count; ++i) {
+		free(entries[i].name);
+	}
+	free(entries);
+	closedir(dir);
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+	const char *ptr = data;
+	while (size > 0) {
+		ssize_t n = write(fd, ptr, size);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		ptr += n;
+		size -= n;
+	}
+	return true;
+}
+
+void image_cache_store(const struct image_cache_key *key,
+		cairo_surface_t *surface) {
+	if (!cache_dir) {
+		return;
+	}
+	uint64_t hash = hash_key(key);
+	char *path = entry_path(hash, IMAGE_CACHE_SUFFIX);
+	char *tmp_path = entry_path(hash, ".XXXXXX");
+	if (!path || !tmp_path) {
+		goto out;
+	}
+	// Written under a temporary name, so that readers never see a partial
+	// entry
+	int fd = mkstemp(tmp_path);
+	if (fd == -1) {
+		swaybg_log_errno(LOG_DEBUG, "Failed to create cache entry");
+		goto out;
+	}
+
+	int width = cairo_image_surface_get_width(surface);
+	int height = cairo_image_surface_get_height(surface);
+	int stride = cairo_image_surface_get_stride(surface);
+	const unsigned char *data = cairo_image_surface_get_data(surface);
+	char header_buf[HEADER_SIZE] = {0};
+	struct image_cache_header header = {
+		.key = hash,
+		.width = width,
+		.height = height,
+		.format = cairo_image_surface_get_format(surface),
+	};
+	memcpy(header.magic, image_cache_magic, sizeof(header.magic));
+	memcpy(header_buf, &header, sizeof(header));
+
+	bool ok = write_all(fd, header_buf, sizeof(header_buf));
+	if (ok && stride == width * 4) {
+		ok = write_all(fd, data, (size_t)stride * height);
+	} else {
+		for (int y = 0; ok && y < height; ++y) {
+			ok = write_all(fd, data + (size_t)y * stride, (size_t)width * 4);
+		}
+	}
+	close(fd);
+	if (!ok || rename(tmp_path, path) == -1) {
+		swaybg_log_errno(LOG_DEBUG, "Failed to write cache entry %s", path);
+		unlink(tmp_path);
+		goto out;
+	}
+	evict_entries();
+
+out:
+	free(path);
+	free(tmp_path);
+}
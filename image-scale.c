@@ -0,0 +1,327 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image-scale.h"
+#include "image-scale-variants.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_SIMD
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define ARM_NEON
+#include <arm_neon.h>
+#endif
+
+// The source pixels contributing to each output pixel along one axis
+struct scale_taps {
+	int count; // per output pixel
+	int *start;
+	uint16_t *weights; // count per output pixel
+};
+
+static int floor_int(double x) {
+	int i = (int)x;
+	return i > x ? i - 1 : i;
+}
+
+static void finish_taps(struct scale_taps *taps) {
+	free(taps->start);
+	free(taps->weights);
+}
+
+static bool init_taps(struct scale_taps *taps, int src_size, int dst_size,
+		enum scale_filter filter) {
+	double ratio = (double)src_size / dst_size;
+	taps->count = filter == SCALE_FILTER_BOX ? (int)ratio + 2 : 2;
+	if (taps->count > src_size) {
+		taps->count = src_size;
+	}
+	taps->start = calloc(dst_size, sizeof(int));
+	taps->weights = calloc((size_t)dst_size * taps->count, sizeof(uint16_t));
+	double *weights = calloc(taps->count, sizeof(double));
+	if (!taps->start || !taps->weights || !weights) {
+		finish_taps(taps);
+		free(weights);
+		return false;
+	}
+
+	for (int i = 0; i < dst_size; ++i) {
+		// Source pixel j covers [j, j + 1)
+		double lo = i * ratio, hi = (i + 1) * ratio;
+		double center = (lo + hi) / 2 - 0.5;
+		int start = filter == SCALE_FILTER_BOX ?
+			floor_int(lo) : floor_int(center);
+		if (start > src_size - taps->count) {
+			start = src_size - taps->count;
+		}
+		if (start < 0) {
+			start = 0;
+		}
+
+		double sum = 0;
+		for (int k = 0; k < taps->count; ++k) {
+			int j = start + k;
+			double w;
+			if (filter == SCALE_FILTER_BOX) {
+				w = (j + 1 < hi ? j + 1 : hi) - (j > lo ? j : lo);
+			} else {
+				w = 1 - (j > center ? j - center : center - j);
+			}
+			weights[k] = w > 0 ? w : 0;
+			sum += weights[k];
+		}
+		if (sum <= 0) {
+			weights[0] = sum = 1;
+		}
+
+		// Rounding leftovers go to the largest weight
+		uint16_t *fixed = &taps->weights[(size_t)i * taps->count];
+		int total = 0, largest = 0;
+		for (int k = 0; k < taps->count; ++k) {
+			fixed[k] = (uint16_t)(weights[k] / sum * WEIGHT_ONE + 0.5);
+			total += fixed[k];
+			if (fixed[k] > fixed[largest]) {
+				largest = k;
+			}
+		}
+		fixed[largest] += WEIGHT_ONE - total;
+		taps->start[i] = start;
+	}
+	free(weights);
+	return true;
+}
+
+static void accumulate_row_scalar(uint32_t *acc, const uint8_t *row,
+		uint16_t weight, int len) {
+	for (int i = 0; i < len; ++i) {
+		acc[i] += (uint32_t)row[i] * weight;
+	}
+}
+
+static void store_row_scalar(const uint32_t *acc, uint8_t *dst, int len) {
+	for (int i = 0; i < len; ++i) {
+		dst[i] = (acc[i] + WEIGHT_ROUND) >> WEIGHT_BITS;
+	}
+}
+
+#ifdef X86_SIMD
+
+/*
+ * Bytes are widened to 32-bit lanes whose upper halves are zero, so
+ * multiplying and adding 16-bit pairs with (weight, 0) is a plain multiply.
+ */
+__attribute__((target("sse2")))
+static void accumulate_row_sse2(uint32_t *acc, const uint8_t *row,
+		uint16_t weight, int len) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i w = _mm_set1_epi32(weight);
+	int i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i px = _mm_loadu_si128((const __m128i *)(row + i));
+		__m128i lo = _mm_unpacklo_epi8(px, zero);
+		__m128i hi = _mm_unpackhi_epi8(px, zero);
+		__m128i words[4] = {
+			_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+			_mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero),
+		};
+		for (int j = 0; j < 4; ++j) {
+			__m128i *out = (__m128i *)(acc + i + 4 * j);
+			_mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out),
+					_mm_madd_epi16(words[j], w)));
+		}
+	}
+	accumulate_row_scalar(acc + i, row + i, weight, len - i);
+}
+
+__attribute__((target("sse2")))
+static void store_row_sse2(const uint32_t *acc, uint8_t *dst, int len) {
+	const __m128i round = _mm_set1_epi32(WEIGHT_ROUND);
+	int i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i words[4];
+		for (int j = 0; j < 4; ++j) {
+			__m128i sum = _mm_loadu_si128((const __m128i *)(acc + i + 4 * j));
+			words[j] = _mm_srli_epi32(_mm_add_epi32(sum, round), WEIGHT_BITS);
+		}
+		__m128i lo = _mm_packs_epi32(words[0], words[1]);
+		__m128i hi = _mm_packs_epi32(words[2], words[3]);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+	store_row_scalar(acc + i, dst + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void accumulate_row_avx2(uint32_t *acc, const uint8_t *row,
+		uint16_t weight, int len) {
+	const __m256i w = _mm256_set1_epi32(weight);
+	int i = 0;
+	for (; i + 8 <= len; i += 8) {
+		__m256i px = _mm256_cvtepu8_epi32(
+				_mm_loadl_epi64((const __m128i *)(row + i)));
+		__m256i *out = (__m256i *)(acc + i);
+		_mm256_storeu_si256(out, _mm256_add_epi32(_mm256_loadu_si256(out),
+				_mm256_madd_epi16(px, w)));
+	}
+	accumulate_row_scalar(acc + i, row + i, weight, len - i);
+}
+
+#endif // X86_SIMD
+
+#ifdef ARM_NEON
+
+static void accumulate_row_neon(uint32_t *acc, const uint8_t *row,
+		uint16_t weight, int len) {
+	int i = 0;
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t px = vld1q_u8(row + i);
+		uint16x8_t lo = vmovl_u8(vget_low_u8(px));
+		uint16x8_t hi = vmovl_u8(vget_high_u8(px));
+		uint16x4_t halves[4] = {
+			vget_low_u16(lo), vget_high_u16(lo),
+			vget_low_u16(hi), vget_high_u16(hi),
+		};
+		for (int j = 0; j < 4; ++j) {
+			uint32_t *out = acc + i + 4 * j;
+			vst1q_u32(out, vmlal_n_u16(vld1q_u32(out), halves[j], weight));
+		}
+	}
+	accumulate_row_scalar(acc + i, row + i, weight, len - i);
+}
+
+static void store_row_neon(const uint32_t *acc, uint8_t *dst, int len) {
+	int i = 0;
+	for (; i + 8 <= len; i += 8) {
+		// Rounding narrowing shifts, the sums are at most 8 + 14 bits
+		uint16x4_t lo = vrshrn_n_u32(vld1q_u32(acc + i), WEIGHT_BITS);
+		uint16x4_t hi = vrshrn_n_u32(vld1q_u32(acc + i + 4), WEIGHT_BITS);
+		vst1_u8(dst + i, vqmovn_u16(vcombine_u16(lo, hi)));
+	}
+	store_row_scalar(acc + i, dst + i, len - i);
+}
+
+#endif // ARM_NEON
+
+#ifdef X86_SIMD
+
+// __builtin_cpu_supports only takes string literals
+static bool has_sse2(void) {
+	return __builtin_cpu_supports("sse2");
+}
+
+static bool has_avx2(void) {
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif // X86_SIMD
+
+const struct accumulate_row_kernel accumulate_row_kernels[] = {
+#if defined(X86_SIMD)
+	{ "avx2", accumulate_row_avx2, has_avx2 },
+	{ "sse2", accumulate_row_sse2, has_sse2 },
+#elif defined(ARM_NEON)
+	{ "neon", accumulate_row_neon, NULL },
+#endif
+	{ "scalar", accumulate_row_scalar, NULL },
+	{ NULL, NULL, NULL },
+};
+
+const struct store_row_kernel store_row_kernels[] = {
+#if defined(X86_SIMD)
+	{ "sse2", store_row_sse2, has_sse2 },
+#elif defined(ARM_NEON)
+	{ "neon", store_row_neon, NULL },
+#endif
+	{ "scalar", store_row_scalar, NULL },
+	{ NULL, NULL, NULL },
+};
+
+bool scale_kernel_supported(bool (*supported)(void)) {
+	return !supported || supported();
+}
+
+static accumulate_row_func get_accumulate_row(void) {
+	const struct accumulate_row_kernel *kernel = accumulate_row_kernels;
+	for (; !scale_kernel_supported(kernel->supported); ++kernel) {
+		// The scalar one is always supported
+	}
+	return kernel->func;
+}
+
+static store_row_func get_store_row(void) {
+	const struct store_row_kernel *kernel = store_row_kernels;
+	for (; !scale_kernel_supported(kernel->supported); ++kernel) {
+		// The scalar one is always supported
+	}
+	return kernel->func;
+}
+
+// The row pass only sees the rows that are already scaled down
+static void scale_row(const uint8_t *src, uint8_t *dst, int dst_width,
+		const struct scale_taps *taps) {
+	for (int x = 0; x < dst_width; ++x) {
+		const uint8_t *px = src + 4 * (size_t)taps->start[x];
+		const uint16_t *weights = &taps->weights[(size_t)x * taps->count];
+		uint32_t sum[4] = { WEIGHT_ROUND, WEIGHT_ROUND,
+			WEIGHT_ROUND, WEIGHT_ROUND };
+		for (int k = 0; k < taps->count; ++k) {
+			for (int c = 0; c < 4; ++c) {
+				sum[c] += (uint32_t)px[4 * k + c] * weights[k];
+			}
+		}
+		for (int c = 0; c < 4; ++c) {
+			dst[4 * x + c] = sum[c] >> WEIGHT_BITS;
+		}
+	}
+}
+
+enum scale_filter scale_filter_for_sizes(int src_size, int dst_size) {
+	return src_size >= 2 * dst_size ?
+		SCALE_FILTER_BOX : SCALE_FILTER_BILINEAR;
+}
+
+bool scale_pixels(const uint8_t *src, int src_width, int src_height,
+		int src_stride, uint8_t *dst, int dst_width, int dst_height,
+		int dst_stride, enum scale_filter filter_x,
+		enum scale_filter filter_y, int first_row, int row_count) {
+	struct scale_taps taps_x, taps_y;
+	if (!init_taps(&taps_x, src_width, dst_width, filter_x)) {
+		return false;
+	}
+	if (!init_taps(&taps_y, src_height, dst_height, filter_y)) {
+		finish_taps(&taps_x);
+		return false;
+	}
+	int len = 4 * src_width;
+	uint32_t *acc = malloc(len * sizeof(uint32_t));
+	uint8_t *column = malloc(len);
+	if (!acc || !column) {
+		free(acc);
+		free(column);
+		finish_taps(&taps_x);
+		finish_taps(&taps_y);
+		return false;
+	}
+
+	accumulate_row_func accumulate_row = get_accumulate_row();
+	store_row_func store_row = get_store_row();
+	for (int y = first_row; y < first_row + row_count; ++y) {
+		const uint16_t *weights = &taps_y.weights[(size_t)y * taps_y.count];
+		memset(acc, 0, len * sizeof(uint32_t));
+		for (int k = 0; k < taps_y.count; ++k) {
+			if (weights[k]) {
+				accumulate_row(acc, src +
+						(size_t)(taps_y.start[y] + k) * src_stride,
+						weights[k], len);
+			}
+		}
+		store_row(acc, column, len);
+		scale_row(column, dst + (size_t)y * dst_stride, dst_width, &taps_x);
+	}
+
+	free(acc);
+	free(column);
+	finish_taps(&taps_x);
+	finish_taps(&taps_y);
+	return true;
+}
@@ -1,5 +1,8 @@
 #ifndef _SWAY_BACKGROUND_IMAGE_H
 #define _SWAY_BACKGROUND_IMAGE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 #include "cairo_util.h"
 
 enum background_mode {
@@ -12,9 +15,46 @@ enum background_mode {
 	BACKGROUND_MODE_INVALID,
 };
 
+// A buffer size the image is going to be drawn at
+struct background_target {
+	enum background_mode mode;
+	int width, height;
+};
+
 enum background_mode parse_background_mode(const char *mode);
-cairo_surface_t *load_background_image(const char *path);
+const char *background_mode_name(enum background_mode mode);
+
+struct background_image_info {
+	int width, height; // full size of the file
+	// If not BACKGROUND_MODE_INVALID, only the part of the image that is
+	// visible in this mode was kept
+	enum background_mode crop_mode;
+	// Of the file as it was read, which identifies the decoded contents
+	struct timespec mtime;
+	int64_t file_size;
+};
+
+// Decodes path at the smallest size that loses no detail for any of the
+// targets, or at its full size if count is 0.
+cairo_surface_t *load_background_image(const char *path,
+		const struct background_target *targets, int count,
+		struct background_image_info *info);
+// The smallest size an image_width by image_height image can be decoded at
+// without losing detail when drawn in mode at the given buffer size.
+void background_image_required_size(int image_width, int image_height,
+		enum background_mode mode, int buffer_width, int buffer_height,
+		int *width, int *height);
+// The size an image_width by image_height image takes up when drawn in mode
+// at the given buffer size, rounded to whole pixels. Returns false unless the
+// image is shrunk in stretch, fill or fit mode.
+bool background_image_scaled_size(int image_width, int image_height,
+		enum background_mode mode, int buffer_width, int buffer_height,
+		int *width, int *height);
 void render_background_image(cairo_t *cairo, cairo_surface_t *image,
 		enum background_mode mode, int buffer_width, int buffer_height);
+// Whether drawing color and then image in mode leaves every pixel opaque.
+// image may be NULL if only the color is drawn.
+bool background_is_opaque(cairo_surface_t *image, enum background_mode mode,
+		uint32_t color);
 
 #endif
@@ -5,21 +5,31 @@
 #include <stdint.h>
 #include <cairo.h>
 #include <wayland-client.h>
-#if HAVE_GDK_PIXBUF
-#include <gdk-pixbuf/gdk-pixbuf.h>
-#endif
 
 void cairo_set_source_u32(cairo_t *cairo, uint32_t color);
 cairo_subpixel_order_t to_cairo_subpixel_order(enum wl_output_subpixel subpixel);
 
+// Scales an image with a 32-bit format with a box filter for large
+// reductions and bilinear filtering otherwise, on the calling thread. The
+// result has the same format. Returns NULL if out of memory.
 cairo_surface_t *cairo_image_surface_scale(cairo_surface_t *image,
 		int width, int height);
 
-#if HAVE_GDK_PIXBUF
-
-cairo_surface_t* gdk_cairo_image_surface_create_from_pixbuf(
-		const GdkPixbuf *gdkbuf);
-
-#endif // HAVE_GDK_PIXBUF
+// Copies the pixels of src into dest, which must have the same size and
+// a 32-bit format.
+void cairo_image_surface_copy(cairo_surface_t *dest, cairo_surface_t *src);
+// Like cairo_image_surface_copy, but only the pixels within rect.
+void cairo_image_surface_copy_rect(cairo_surface_t *dest,
+		cairo_surface_t *src, const cairo_rectangle_int_t *rect);
+// Fills a surface with a 32-bit format by repeating its top left
+// tile_width x tile_height pixels.
+void cairo_image_surface_repeat(cairo_surface_t *surface,
+		int tile_width, int tile_height);
+// Compares two surfaces of the same size and 32-bit format in tiles of
+// tile_size pixels, and stores the rectangles covering the tiles that differ
+// in rects. Returns their number, 0 if the surfaces are identical. If more
+// than max_rects would be needed, a single bounding rectangle is stored.
+int cairo_image_surface_diff(cairo_surface_t *a, cairo_surface_t *b,
+		int tile_size, cairo_rectangle_int_t *rects, int max_rects);
 
 #endif
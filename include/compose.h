@@ -0,0 +1,27 @@
+#ifndef _SWAYBG_COMPOSE_H
+#define _SWAYBG_COMPOSE_H
+#include <stdint.h>
+#include <cairo.h>
+#include "background-image.h"
+#include "worker.h"
+
+/*
+ * Drawing a background into a buffer, without anything Wayland specific, so
+ * that it can run on the worker threads. The work is split into bands that
+ * are spread over workers.
+ */
+
+// Cairo's filters either alias or get slow when shrinking an image a lot, so
+// images are brought to the size they are drawn at with a separable box or
+// bilinear filter first. Like cairo_image_surface_scale, but in bands spread
+// over the workers. Returns NULL if out of memory.
+cairo_surface_t *downscale_image(struct worker_pool *workers,
+		cairo_surface_t *image, int width, int height);
+// Composes image over color at the given buffer size. This may run on a
+// worker thread too, so image must have been flushed beforehand and must
+// not be drawn to in the meantime.
+cairo_surface_t *compose_background(struct worker_pool *workers,
+		cairo_surface_t *image, enum background_mode mode, uint32_t color,
+		int width, int height);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef _SWAYBG_CONTROL_H
+#define _SWAYBG_CONTROL_H
+#include <stdbool.h>
+#include "log.h"
+
+/*
+ * A UNIX socket that accepts newline separated commands. The protocol itself
+ * is left to the command callback; this only handles connections, line
+ * framing and replies.
+ */
+struct control_server;
+struct control_client;
+struct loop;
+
+struct control_handler {
+	// Called for every complete line, without the trailing newline
+	void (*command)(void *data, struct control_client *client, char *line);
+	// Called once all lines that arrived together have been handled
+	void (*batch_done)(void *data);
+	void *data;
+};
+
+struct control_server *control_server_create(struct loop *loop,
+		const char *path, const struct control_handler *handler);
+void control_server_destroy(struct control_server *server);
+
+void control_client_reply(struct control_client *client, const char *fmt, ...)
+	_ATTRIB_PRINTF(2, 3);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef _SWAYBG_IMAGE_CACHE_H
+#define _SWAYBG_IMAGE_CACHE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "background-image.h"
+
+/*
+ * An on-disk cache of backgrounds that have already been decoded, converted
+ * and scaled to a buffer size. Entries are stored in cairo's pixel layout
+ * under $XDG_CACHE_HOME/swaybg, so that a hit is simply mapped into memory.
+ */
+struct image_cache_key {
+	const char *path; // of the source image
+	// Of the source image when it was decoded, see image_cache_stat_source
+	struct timespec mtime;
+	int64_t file_size;
+	int width, height;
+	enum background_mode mode;
+	uint32_t color;
+};
+
+// Returns false if there is no usable cache directory, which disables it.
+bool image_cache_init(void);
+void image_cache_finish(void);
+
+// Sets mtime and file_size from the file at path as it is now, to look up
+// scaled copies of its current contents. Returns false if it does not exist.
+bool image_cache_stat_source(struct image_cache_key *key);
+// Returns a surface backed by a mapping of the cache entry, or NULL.
+cairo_surface_t *image_cache_load(const struct image_cache_key *key);
+// Writes surface to the cache, evicting the least recently used entries if
+// it grows too big. Blocks on I/O; may be called from worker threads.
+void image_cache_store(const struct image_cache_key *key,
+		cairo_surface_t *surface);
+
+#endif
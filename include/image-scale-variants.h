@@ -0,0 +1,45 @@
+#ifndef _SWAYBG_IMAGE_SCALE_VARIANTS_H
+#define _SWAYBG_IMAGE_SCALE_VARIANTS_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Weights are 2.14 fixed point and sum up to exactly WEIGHT_ONE for every
+ * output pixel, so that flat areas come out unchanged. A byte times the sum
+ * of the weights still fits in 22 bits.
+ */
+#define WEIGHT_BITS 14
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+#define WEIGHT_ROUND (1 << (WEIGHT_BITS - 1))
+
+/*
+ * The column pass adds whole source rows into a row of accumulators, one
+ * per byte, and touches every source pixel. That is where the time goes,
+ * so it has SIMD variants. They compute the same sums as the scalar code,
+ * which the tests check for every variant the CPU supports.
+ */
+typedef void (*accumulate_row_func)(uint32_t *acc, const uint8_t *row,
+		uint16_t weight, int len);
+// Divides the sums by WEIGHT_ONE with rounding, they must not exceed
+// 255 * WEIGHT_ONE
+typedef void (*store_row_func)(const uint32_t *acc, uint8_t *dst, int len);
+
+struct accumulate_row_kernel {
+	const char *name; // of the instruction set
+	accumulate_row_func func;
+	bool (*supported)(void); // NULL if always supported
+};
+
+struct store_row_kernel {
+	const char *name;
+	store_row_func func;
+	bool (*supported)(void);
+};
+
+// Fastest first, ending with the scalar one and an entry without a name
+extern const struct accumulate_row_kernel accumulate_row_kernels[];
+extern const struct store_row_kernel store_row_kernels[];
+
+bool scale_kernel_supported(bool (*supported)(void));
+
+#endif
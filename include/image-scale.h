@@ -0,0 +1,30 @@
+#ifndef _SWAYBG_IMAGE_SCALE_H
+#define _SWAYBG_IMAGE_SCALE_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Resamples 32-bit pixels in two separable passes, first along columns and
+ * then along rows. Every byte is filtered on its own, so premultiplied ARGB
+ * and xRGB words work alike in either byte order.
+ */
+enum scale_filter {
+	SCALE_FILTER_BILINEAR,
+	// Area averaging, every source pixel contributes by how much of an
+	// output pixel it covers
+	SCALE_FILTER_BOX,
+};
+
+// Bilinear below 2:1, area averaging from there on, where bilinear would
+// skip source pixels and alias
+enum scale_filter scale_filter_for_sizes(int src_size, int dst_size);
+
+// Scales src into the rows [first_row, first_row + row_count) of dst, which
+// is dst_width x dst_height pixels in total. Bands of one image may be
+// scaled on different threads. Returns false if out of memory.
+bool scale_pixels(const uint8_t *src, int src_width, int src_height,
+		int src_stride, uint8_t *dst, int dst_width, int dst_height,
+		int dst_stride, enum scale_filter filter_x,
+		enum scale_filter filter_y, int first_row, int row_count);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef _SWAYBG_LOOP_H
+#define _SWAYBG_LOOP_H
+#include <stdbool.h>
+
+/**
+ * This is an event loop system designed for swaybg clients. Not for general
+ * purpose use.
+ */
+struct loop;
+
+struct loop_timer;
+
+/**
+ * Create an event loop.
+ */
+struct loop *loop_create(void);
+
+/**
+ * Destroy the event loop (eg. on program termination).
+ */
+void loop_destroy(struct loop *loop);
+
+/**
+ * Poll the event loop. This will block until one of the event sources is
+ * ready, then call its callback and return.
+ */
+void loop_poll(struct loop *loop);
+
+/**
+ * Add a file descriptor to the loop.
+ */
+bool loop_add_fd(struct loop *loop, int fd, short mask,
+		void (*func)(int fd, short mask, void *data), void *data);
+
+/**
+ * Change the events a file descriptor is polled for.
+ */
+bool loop_set_fd_mask(struct loop *loop, int fd, short mask);
+
+/**
+ * Add a timer to the event loop.
+ */
+struct loop_timer *loop_add_timer(struct loop *loop, int ms,
+		void (*callback)(void *data), void *data);
+
+/**
+ * Remove a file descriptor from the event loop.
+ */
+bool loop_remove_fd(struct loop *loop, int fd);
+
+/**
+ * Remove a timer from the event loop.
+ */
+bool loop_remove_timer(struct loop *loop, struct loop_timer *timer);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef _SWAYBG_PERF_H
+#define _SWAYBG_PERF_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "log.h"
+
+/*
+ * Timings of the expensive steps of drawing a background, written as one
+ * JSON object per line to the file named by $SWAYBG_PERF_LOG. Every record
+ * has the operation, its duration, the number of pixels it produced, the
+ * time per pixel and the peak resident memory so far:
+ *
+ *   {"op":"scale","ns":8125000,"pixels":2073600,"ns_per_pixel":3.918,
+ *    "maxrss_kb":61234,"mode":"fill","src_width":3840,...}
+ *
+ * Does nothing if the variable is unset.
+ */
+void perf_init(void);
+void perf_finish(void);
+
+// A timestamp to pass to perf_record, 0 if recording is disabled
+int64_t perf_start(void);
+// Records an operation that began at start. fmt, if not NULL, adds more
+// members to the object and must be a JSON fragment such as "\"a\":%d".
+// May be called from worker threads.
+void perf_record(const char *op, int64_t start, int64_t pixels,
+		const char *fmt, ...) _ATTRIB_PRINTF(4, 5);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef _SWAYBG_PIXEL_CONVERT_VARIANTS_H
+#define _SWAYBG_PIXEL_CONVERT_VARIANTS_H
+#include <stdbool.h>
+#include "pixel-convert.h"
+
+/*
+ * Every implementation built for the target architecture, so that the tests
+ * can check each one the CPU supports, not just the one picked at runtime.
+ */
+struct row_converter {
+	const char *name; // of the instruction set
+	convert_row_func convert;
+	bool (*supported)(void); // NULL if always supported
+};
+
+// Fastest first, ending with the scalar one and an entry without a name
+extern const struct row_converter rgb_row_converters[];
+extern const struct row_converter rgba_row_converters[];
+
+bool row_converter_supported(const struct row_converter *converter);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef _SWAYBG_PIXEL_CONVERT_H
+#define _SWAYBG_PIXEL_CONVERT_H
+#include <stdint.h>
+
+/*
+ * Converts one row of width pixels from GdkPixbuf's byte order (RGB or RGBA)
+ * to cairo's native endian xRGB/ARGB words. RGBA rows are premultiplied.
+ */
+typedef void (*convert_row_func)(const uint8_t *src, uint8_t *dst, int width);
+
+// Reference implementations, the SIMD variants match them bit for bit
+void convert_rgb_row_scalar(const uint8_t *src, uint8_t *dst, int width);
+void convert_rgba_row_scalar(const uint8_t *src, uint8_t *dst, int width);
+
+// Return the fastest implementation supported by the running CPU
+convert_row_func get_rgb_row_converter(void);
+convert_row_func get_rgba_row_converter(void);
+
+#endif
@@ -10,13 +10,43 @@ struct pool_buffer {
 	cairo_surface_t *surface;
 	cairo_t *cairo;
 	uint32_t width, height;
+	uint32_t format; // enum wl_shm_format, ARGB8888 or XRGB8888
 	void *data;
 	size_t size;
 	bool busy;
+	bool destroy_on_release;
+	// Attachments to surfaces since it was last drawn into. A release does
+	// not tell which attachment it ends, so buffers attached more than once
+	// are never drawn into again.
+	uint32_t attach_count;
 };
 
-struct pool_buffer *get_next_buffer(struct wl_shm *shm,
-		struct pool_buffer pool[static 2], uint32_t width, uint32_t height);
+/*
+ * For content that is drawn once and then left alone. The pool keeps a
+ * single buffer; the second one is only allocated while the first is still
+ * held by the compositor, and the superseded buffer is freed as soon as it is
+ * released.
+ */
+struct pool_buffer *get_single_buffer(struct wl_shm *shm,
+		struct pool_buffer pool[static 2], uint32_t width, uint32_t height,
+		uint32_t format);
 void destroy_buffer(struct pool_buffer *buffer);
+/*
+ * The part of creating a buffer that needs no compositor: maps shared memory
+ * for it and wraps that in a cairo surface, but leaves buffer->buffer unset.
+ * Returns the file to hand to wl_shm, which the caller closes, or -1.
+ */
+int map_buffer(struct pool_buffer *buffer, int32_t width, int32_t height,
+		uint32_t format);
+// Whether the buffer may be drawn into in place
+bool pool_buffer_is_free(const struct pool_buffer *buffer);
+
+// Totals over all buffers, for the statistics logged at exit
+struct pool_buffer_stats {
+	uint64_t created;
+	size_t bytes, peak_bytes; // of shared memory currently and at most
+};
+
+void get_pool_buffer_stats(struct pool_buffer_stats *stats);
 
 #endif
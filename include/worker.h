@@ -0,0 +1,35 @@
+#ifndef _SWAYBG_WORKER_H
+#define _SWAYBG_WORKER_H
+#include <stdbool.h>
+
+/*
+ * A pool of threads for work that should not block the Wayland event loop.
+ * Jobs run on the workers, and their completion callbacks are handed back to
+ * whichever thread calls worker_pool_dispatch, which is meant to be the main
+ * loop once the pool's fd becomes readable.
+ */
+struct worker_pool;
+
+typedef void (*worker_func)(void *data);
+typedef void (*worker_band_func)(void *data, int index);
+
+struct worker_pool *worker_pool_create(void);
+// Waits for running jobs. Jobs that have not started yet are skipped, but
+// the done callback of every submitted job is still called.
+void worker_pool_destroy(struct worker_pool *pool);
+
+// Runs work(data) on a worker thread, then done(data) from the next
+// worker_pool_dispatch call after it has finished.
+bool worker_pool_submit(struct worker_pool *pool, worker_func work,
+		worker_func done, void *data);
+// Readable whenever finished jobs are waiting for worker_pool_dispatch
+int worker_pool_get_fd(struct worker_pool *pool);
+void worker_pool_dispatch(struct worker_pool *pool);
+
+// Calls func(data, i) for every i in [0, count), spread over the workers
+// and the calling thread, and returns once all calls have finished.
+void worker_pool_run_bands(struct worker_pool *pool, worker_band_func func,
+		void *data, int count);
+int worker_pool_get_thread_count(struct worker_pool *pool);
+
+#endif
@@ -0,0 +1,262 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wayland-client.h>
+#include "log.h"
+#include "loop.h"
+
+struct loop_fd_event {
+	void (*callback)(int fd, short mask, void *data);
+	void *data;
+	bool removed;
+	struct wl_list link; // struct loop::fd_events
+};
+
+struct loop_timer {
+	void (*callback)(void *data);
+	void *data;
+	struct timespec expiry;
+	bool removed;
+	struct wl_list link; // struct loop::timers
+};
+
+struct loop {
+	// fds[i] belongs to the i-th entry of fd_events
+	struct pollfd *fds;
+	int fd_length;
+	int fd_capacity;
+
+	struct wl_list fd_events; // struct loop_fd_event::link
+	struct wl_list timers; // struct loop_timer::link
+};
+
+struct loop *loop_create(void) {
+	struct loop *loop = calloc(1, sizeof(struct loop));
+	if (!loop) {
+		swaybg_log(LOG_ERROR, "Unable to allocate memory for loop");
+		return NULL;
+	}
+	loop->fd_capacity = 10;
+	loop->fds = malloc(sizeof(struct pollfd) * loop->fd_capacity);
+	if (!loop->fds) {
+		swaybg_log(LOG_ERROR, "Unable to allocate memory for loop");
+		free(loop);
+		return NULL;
+	}
+	wl_list_init(&loop->fd_events);
+	wl_list_init(&loop->timers);
+	return loop;
+}
+
+void loop_destroy(struct loop *loop) {
+	struct loop_fd_event *event = NULL, *tmp_event = NULL;
+	wl_list_for_each_safe(event, tmp_event, &loop->fd_events, link) {
+		wl_list_remove(&event->link);
+		free(event);
+	}
+	struct loop_timer *timer = NULL, *tmp_timer = NULL;
+	wl_list_for_each_safe(timer, tmp_timer, &loop->timers, link) {
+		wl_list_remove(&timer->link);
+		free(timer);
+	}
+	free(loop->fds);
+	free(loop);
+}
+
+// Drops the fds and timers that were removed while dispatching
+static void loop_compact(struct loop *loop) {
+	int fd_index = 0, kept = 0;
+	struct loop_fd_event *event = NULL, *tmp_event = NULL;
+	wl_list_for_each_safe(event, tmp_event, &loop->fd_events, link) {
+		if (event->removed) {
+			wl_list_remove(&event->link);
+			free(event);
+		} else {
+			loop->fds[kept++] = loop->fds[fd_index];
+		}
+		++fd_index;
+	}
+	loop->fd_length = kept;
+
+	struct loop_timer *timer = NULL, *tmp_timer = NULL;
+	wl_list_for_each_safe(timer, tmp_timer, &loop->timers, link) {
+		if (timer->removed) {
+			wl_list_remove(&timer->link);
+			free(timer);
+		}
+	}
+}
+
+static bool timer_expired(struct loop_timer *timer, struct timespec *now) {
+	return timer->expiry.tv_sec < now->tv_sec ||
+		(timer->expiry.tv_sec == now->tv_sec &&
+		 timer->expiry.tv_nsec <= now->tv_nsec);
+}
+
+void loop_poll(struct loop *loop) {
+	loop_compact(loop);
+
+	// Calculate next timer in ms, rounded up so that it has expired by then
+	int ms = -1;
+	if (!wl_list_empty(&loop->timers)) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		struct loop_timer *timer = NULL;
+		wl_list_for_each(timer, &loop->timers, link) {
+			int64_t timer_ns =
+				(int64_t)(timer->expiry.tv_sec - now.tv_sec) * 1000000000 +
+				(timer->expiry.tv_nsec - now.tv_nsec);
+			int64_t timer_ms = timer_ns <= 0 ? 0 : (timer_ns + 999999) / 1000000;
+			if (timer_ms > INT32_MAX) {
+				timer_ms = INT32_MAX;
+			}
+			if (ms == -1 || timer_ms < ms) {
+				ms = timer_ms;
+			}
+		}
+	}
+
+	if (poll(loop->fds, loop->fd_length, ms) == -1) {
+		if (errno != EINTR) {
+			swaybg_log_errno(LOG_ERROR, "poll failed");
+		}
+		return;
+	}
+
+	// Dispatch fds. Callbacks may add or remove fds, so look each one up by
+	// index and skip those removed in the meantime.
+	int fd_index = 0;
+	struct loop_fd_event *event = NULL;
+	wl_list_for_each(event, &loop->fd_events, link) {
+		struct pollfd pfd = loop->fds[fd_index++];
+		if (event->removed) {
+			continue;
+		}
+
+		// Always send these events
+		unsigned events = pfd.events | POLLHUP | POLLERR | POLLNVAL;
+		if (pfd.revents & events) {
+			event->callback(pfd.fd, pfd.revents, event->data);
+		}
+	}
+
+	// Dispatch timers
+	if (!wl_list_empty(&loop->timers)) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		struct loop_timer *timer = NULL;
+		wl_list_for_each(timer, &loop->timers, link) {
+			if (!timer->removed && timer_expired(timer, &now)) {
+				timer->removed = true;
+				timer->callback(timer->data);
+			}
+		}
+	}
+}
+
+bool loop_add_fd(struct loop *loop, int fd, short mask,
+		void (*callback)(int fd, short mask, void *data), void *data) {
+	struct loop_fd_event *event = calloc(1, sizeof(struct loop_fd_event));
+	if (!event) {
+		swaybg_log(LOG_ERROR, "Unable to allocate memory for event");
+		return false;
+	}
+	event->callback = callback;
+	event->data = data;
+
+	if (loop->fd_length == loop->fd_capacity) {
+		int capacity = loop->fd_capacity + 10;
+		struct pollfd *fds =
+			realloc(loop->fds, sizeof(struct pollfd) * capacity);
+		if (!fds) {
+			swaybg_log(LOG_ERROR, "Unable to allocate memory for pollfd");
+			free(event);
+			return false;
+		}
+		loop->fds = fds;
+		loop->fd_capacity = capacity;
+	}
+
+	wl_list_insert(loop->fd_events.prev, &event->link);
+	struct pollfd pfd = { .fd = fd, .events = mask, .revents = 0 };
+	loop->fds[loop->fd_length++] = pfd;
+	return true;
+}
+
+static struct pollfd *loop_find_fd(struct loop *loop, int fd,
+		struct loop_fd_event **event_out) {
+	int fd_index = 0;
+	struct loop_fd_event *event = NULL;
+	wl_list_for_each(event, &loop->fd_events, link) {
+		struct pollfd *pfd = &loop->fds[fd_index++];
+		if (!event->removed && pfd->fd == fd) {
+			if (event_out) {
+				*event_out = event;
+			}
+			return pfd;
+		}
+	}
+	return NULL;
+}
+
+bool loop_set_fd_mask(struct loop *loop, int fd, short mask) {
+	struct pollfd *pfd = loop_find_fd(loop, fd, NULL);
+	if (!pfd) {
+		return false;
+	}
+	pfd->events = mask;
+	return true;
+}
+
+struct loop_timer *loop_add_timer(struct loop *loop, int ms,
+		void (*callback)(void *data), void *data) {
+	struct loop_timer *timer = calloc(1, sizeof(struct loop_timer));
+	if (!timer) {
+		swaybg_log(LOG_ERROR, "Unable to allocate memory for timer");
+		return NULL;
+	}
+	timer->callback = callback;
+	timer->data = data;
+
+	clock_gettime(CLOCK_MONOTONIC, &timer->expiry);
+	timer->expiry.tv_sec += ms / 1000;
+
+	long int nsec = (ms % 1000) * 1000000;
+	if (timer->expiry.tv_nsec + nsec >= 1000000000) {
+		timer->expiry.tv_sec++;
+		nsec -= 1000000000;
+	}
+	timer->expiry.tv_nsec += nsec;
+
+	wl_list_insert(loop->timers.prev, &timer->link);
+
+	return timer;
+}
+
+bool loop_remove_fd(struct loop *loop, int fd) {
+	struct loop_fd_event *event = NULL;
+	struct pollfd *pfd = loop_find_fd(loop, fd, &event);
+	if (!pfd) {
+		return false;
+	}
+	// Freed by the next loop_poll, the fd may be in the middle of dispatch
+	event->removed = true;
+	pfd->fd = -1;
+	return true;
+}
+
+bool loop_remove_timer(struct loop *loop, struct loop_timer *timer) {
+	struct loop_timer *t = NULL;
+	wl_list_for_each(t, &loop->timers, link) {
+		if (t == timer && !t->removed) {
+			t->removed = true;
+			return true;
+		}
+	}
+	return false;
+}
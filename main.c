@@ -1,17 +1,32 @@
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
+#include <libgen.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <wayland-client.h>
 #include "background-image.h"
 #include "cairo_util.h"
+#include "compose.h"
+#include "control.h"
+#include "image-cache.h"
 #include "log.h"
+#include "loop.h"
+#include "perf.h"
 #include "pool-buffer.h"
+#include "fractional-scale-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
+#include "worker.h"
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
 #include "xdg-output-unstable-v1-client-protocol.h"
 
@@ -39,19 +54,119 @@ struct swaybg_state {
 	struct wl_shm *shm;
 	struct zwlr_layer_shell_v1 *layer_shell;
 	struct zxdg_output_manager_v1 *xdg_output_manager;
+	struct wp_viewporter *viewporter;
+	struct wp_fractional_scale_manager_v1 *fractional_scale_manager;
+	struct loop *loop;
+	struct worker_pool *workers;
+	struct control_server *control;
+	struct wl_list images;  // struct swaybg_image::link
 	struct wl_list configs;  // struct swaybg_output_config::link
 	struct wl_list outputs;  // struct swaybg_output::link
+	struct wl_list frames;  // struct swaybg_frame::link
+	struct wl_list compose_jobs;  // struct compose_job::link
 	bool run_display;
+	bool display_read_prepared;
+	bool low_memory;
+	bool no_cache; // of scaled images on disk
+	bool watch_images;
+	int watch_fd; // inotify instance, -1 unless watching images
+	const char *control_path;
+	bool configs_changed; // by control commands, since the last batch
+	uint32_t next_slideshow_id;
+};
+
+/*
+ * An image file referenced by one or more configs. Decoding is deferred until
+ * an output using one of those configs shows up, and happens on a worker
+ * thread.
+ */
+struct swaybg_image {
+	struct swaybg_state *state;
+	char *path;
+	cairo_surface_t *surface; // NULL until loaded, may be scaled down
+	struct background_image_info info; // once loaded
+	bool loading;
+	bool load_failed;
+	// Watch on the containing directory, so that files replaced by a rename
+	// are noticed as well. Shared by all images in the same directory.
+	int watch;
+	char *watch_name; // file name within the watched directory
+	struct loop_timer *reload_timer; // pending debounced reload
+	struct wl_list link; // struct swaybg_state::images
+};
+
+/*
+ * Number of pre-scaled frames kept per config. Outputs usually settle on one
+ * size each, so this only has to cover a handful of distinct heads plus the
+ * transient sizes seen while outputs are being reconfigured.
+ */
+#define SCALED_IMAGE_CACHE_SIZE 4
+
+struct swaybg_scaled_image {
+	struct swaybg_image *image; // the current or next slide
+	cairo_surface_t *surface;
+	int width, height;
+	struct wl_list link; // struct swaybg_output_config::scaled_images
+};
+
+#define DEFAULT_SLIDE_INTERVAL 300 // seconds
+
+/*
+ * A config with several images shows them in turn. While one is shown, the
+ * next one is decoded and scaled to the buffer sizes of the outputs in the
+ * background, so that switching only has to copy the pre-scaled pixels.
+ */
+struct swaybg_slideshow {
+	struct swaybg_state *state;
+	struct swaybg_output_config *config;
+	// Unlike the address, never reused by a later slideshow
+	uint32_t id;
+	struct swaybg_image **images;
+	size_t count, index; // index of config->image
+	struct loop_timer *timer;
+	bool prefetching;
 };
 
 struct swaybg_output_config {
 	char *output;
-	cairo_surface_t *image;
+	struct swaybg_image *image;
 	enum background_mode mode;
 	uint32_t color;
+	// Bumped whenever the above change, to tell stale frames apart
+	uint32_t generation;
+	struct swaybg_slideshow *slideshow; // NULL unless there are several images
+	int interval; // seconds between slides, 0 for the default
+	struct wl_list scaled_images; // most recently used first
 	struct wl_list link;
 };
 
+/*
+ * Frames are compared in tiles of this size when their config changes, and
+ * at most this many rectangles are damaged before falling back to their
+ * bounding box.
+ */
+#define DAMAGE_TILE_SIZE 64
+#define MAX_DAMAGE_RECTS 16
+
+/*
+ * A rendered background, shared by every output that shows the same config
+ * at the same buffer size. Its buffer is attached to all of their surfaces.
+ */
+struct swaybg_frame {
+	struct swaybg_output_config *config;
+	uint32_t generation;
+	uint32_t width, height;
+	struct pool_buffer buffers[2];
+	struct pool_buffer *current_buffer;
+	bool opaque;
+	// Bumped by every update in place, damage is what the last one changed
+	uint32_t serial;
+	cairo_rectangle_int_t damage[MAX_DAMAGE_RECTS];
+	int damage_count;
+	int refs;
+	struct wl_list link; // struct swaybg_state::frames
+};
+
 struct swaybg_output {
 	uint32_t wl_name;
 	struct wl_output *wl_output;
@@ -64,26 +179,66 @@ struct swaybg_output {
 
 	struct wl_surface *surface;
 	struct zwlr_layer_surface_v1 *layer_surface;
-	struct pool_buffer buffers[2];
-	struct pool_buffer *current_buffer;
+	struct wp_viewport *viewport;
+	struct wp_fractional_scale_v1 *fractional_scale;
+	struct swaybg_frame *frame;
+	uint32_t frame_serial; // of the frame contents last committed
+	bool image_pending; // waiting for its image to be decoded or composed
+	bool compose_failed; // drawn without a pre-scaled frame instead
+	bool unconfigured; // kept without a surface until a command matches it
+	bool dirty; // rendered once the pending events have been handled
+	// What was last committed; rendering the same state again is skipped
+	struct {
+		struct swaybg_output_config *config;
+		uint32_t generation;
+		uint32_t width, height;
+		uint32_t scale; // in 120ths
+	} committed;
 
 	uint32_t width, height;
 	int32_t scale;
+	// In 120ths, 0 unless the compositor supports fractional scales
+	uint32_t preferred_scale;
+
+	// Logged when the output goes away
+	struct {
+		uint32_t renders_requested, renders, unchanged;
+		uint32_t commits;
+		uint32_t redundant_commits; // of contents already committed
+		uint32_t damage_rects;
+		uint64_t damaged_pixels;
+	} stats;
 
 	struct wl_list link;
 };
 
+// The scale of the output in 120ths
+static uint32_t get_output_scale(struct swaybg_output *output) {
+	return output->preferred_scale ?
+		output->preferred_scale : (uint32_t)output->scale * 120;
+}
+
+// The size of the output in physical pixels
+static void get_buffer_size(struct swaybg_output *output,
+		int *width, int *height) {
+	// Rounded half away from zero, like wp_fractional_scale_v1 asks for
+	uint32_t scale = get_output_scale(output);
+	*width = (output->width * scale + 60) / 120;
+	*height = (output->height * scale + 60) / 120;
+}
+
 bool is_valid_color(const char *color) {
-	int len = strlen(color);
-	if (len != 7 || color[0] != '#') {
+	const char *digits = color[0] == '#' ? color + 1 : color;
+	int len = strlen(digits);
+	if (len != 6 && len != 8) {
 		swaybg_log(LOG_ERROR, "%s is not a valid color for swaybg. "
-				"Color should be specified as #rrggbb (no alpha).", color);
+				"Color should be specified as [#]rrggbb[aa].", color);
 		return false;
 	}
 
 	int i;
-	for (i = 1; i < len; ++i) {
-		if (!isxdigit(color[i])) {
+	for (i = 0; i < len; ++i) {
+		if (!isxdigit((unsigned char)digits[i])) {
 			return false;
 		}
 	}
@@ -91,35 +246,1267 @@ bool is_valid_color(const char *color) {
 	return true;
 }
 
-static void render_frame(struct swaybg_output *output) {
-	int buffer_width = output->width * output->scale,
-		buffer_height = output->height * output->scale;
-	output->current_buffer = get_next_buffer(output->state->shm,
-			output->buffers, buffer_width, buffer_height);
-	if (!output->current_buffer) {
+static void watch_image(struct swaybg_image *image);
+
+static struct swaybg_image *get_swaybg_image(struct swaybg_state *state,
+		const char *path) {
+	struct swaybg_image *image;
+	wl_list_for_each(image, &state->images, link) {
+		if (strcmp(image->path, path) == 0) {
+			return image;
+		}
+	}
+
+	image = calloc(1, sizeof(struct swaybg_image));
+	if (!image) {
+		swaybg_log(LOG_ERROR, "Failed to allocate image");
+		return NULL;
+	}
+	image->state = state;
+	image->path = strdup(path);
+	image->watch = -1;
+	wl_list_insert(&state->images, &image->link);
+	if (state->watch_fd != -1) {
+		watch_image(image);
+	}
+	return image;
+}
+
+static void schedule_render(struct swaybg_output *output);
+static void invalidate_config(struct swaybg_output_config *config);
+static bool config_uses_image(struct swaybg_output_config *config,
+		struct swaybg_image *image);
+static void prefetch_loaded_slide(struct swaybg_state *state,
+		struct swaybg_image *image);
+
+struct load_image_job {
+	struct swaybg_state *state;
+	struct swaybg_image *image;
+	struct background_target *targets;
+	int target_count;
+	cairo_surface_t *surface;
+	struct background_image_info info;
+	bool reload; // the file changed, replace the current surface
+	bool finished;
+};
+
+static void load_image_work(void *data) {
+	struct load_image_job *job = data;
+	int64_t start = perf_start();
+	job->surface = load_background_image(job->image->path,
+			job->targets, job->target_count, &job->info);
+	if (job->surface) {
+		int width = cairo_image_surface_get_width(job->surface);
+		int height = cairo_image_surface_get_height(job->surface);
+		perf_record("decode", start, (int64_t)width * height,
+				"\"image_width\":%d,\"image_height\":%d,"
+				"\"width\":%d,\"height\":%d",
+				job->info.width, job->info.height, width, height);
+	}
+	job->finished = true;
+}
+
+static void load_image_done(void *data) {
+	struct load_image_job *job = data;
+	struct swaybg_state *state = job->state;
+	struct swaybg_image *image = job->image;
+	image->loading = false;
+	bool reloaded = false;
+	// Not finished if the worker pool was shut down before it got to it
+	if (job->finished) {
+		if (job->surface) {
+			if (image->surface) {
+				cairo_surface_destroy(image->surface);
+			}
+			image->surface = job->surface;
+			image->info = job->info;
+			image->load_failed = false;
+			reloaded = job->reload;
+		} else if (job->reload) {
+			// Keep showing the previous contents
+			swaybg_log(LOG_ERROR, "Failed to reload image: %s", image->path);
+		} else {
+			swaybg_log(LOG_ERROR, "Failed to load image: %s", image->path);
+			image->load_failed = true;
+		}
+	}
+	free(job->targets);
+	free(job);
+
+	if (!state->run_display) {
+		return;
+	}
+	if (reloaded) {
+		struct swaybg_output_config *config;
+		wl_list_for_each(config, &state->configs, link) {
+			if (config_uses_image(config, image)) {
+				invalidate_config(config);
+			}
+		}
+	}
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (!output->config || output->config->image != image) {
+			continue;
+		}
+		if (output->image_pending || (reloaded && output->frame)) {
+			schedule_render(output);
+		}
+	}
+	if (image->surface) {
+		prefetch_loaded_slide(state, image);
+	}
+}
+
+/*
+ * Collects the buffer sizes of the outputs showing image, or about to show it
+ * in a slideshow, so that it is decoded no bigger than they need.
+ */
+static int get_image_targets(struct swaybg_state *state,
+		struct swaybg_image *image, struct background_target **targets) {
+	*targets = calloc(wl_list_length(&state->outputs) + 1,
+			sizeof(struct background_target));
+	if (!*targets) {
+		return 0;
+	}
+	int count = 0;
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (!output->config || !config_uses_image(output->config, image) ||
+				output->config->mode == BACKGROUND_MODE_SOLID_COLOR ||
+				!output->width || !output->height) {
+			continue;
+		}
+		struct background_target *target = &(*targets)[count++];
+		target->mode = output->config->mode;
+		get_buffer_size(output, &target->width, &target->height);
+	}
+	return count;
+}
+
+// Whether the decoded image has enough detail for the given buffer size
+static bool image_has_detail_for(struct swaybg_image *image,
+		enum background_mode mode, int width, int height) {
+	int required_width, required_height;
+	if (image->info.crop_mode != BACKGROUND_MODE_INVALID) {
+		// Only the part visible in crop_mode at the largest size was kept
+		if (mode != image->info.crop_mode) {
+			return false;
+		}
+		required_width = width < image->info.width ? width : image->info.width;
+		required_height =
+			height < image->info.height ? height : image->info.height;
+	} else {
+		background_image_required_size(image->info.width, image->info.height,
+				mode, width, height, &required_width, &required_height);
+	}
+	return cairo_image_surface_get_width(image->surface) >= required_width &&
+		cairo_image_surface_get_height(image->surface) >= required_height;
+}
+
+/*
+ * Starts decoding image in the background. Outputs that need it set
+ * image_pending and are rendered once it is done.
+ */
+static void submit_image_job(struct swaybg_state *state,
+		struct swaybg_image *image, bool reload) {
+	struct load_image_job *job = calloc(1, sizeof(struct load_image_job));
+	if (!job) {
+		swaybg_log(LOG_ERROR, "Failed to allocate image job");
+		return;
+	}
+	job->state = state;
+	job->image = image;
+	job->reload = reload;
+	job->target_count = get_image_targets(state, image, &job->targets);
+	swaybg_log(LOG_DEBUG, "%s image %s", reload ? "Reloading" : "Loading",
+			image->path);
+	image->loading = true;
+	if (!worker_pool_submit(state->workers, load_image_work,
+			load_image_done, job)) {
+		image->loading = false;
+		free(job->targets);
+		free(job);
+	}
+}
+
+static void load_swaybg_image(struct swaybg_state *state,
+		struct swaybg_image *image) {
+	if (image->loading || image->load_failed) {
+		return;
+	}
+	if (image->surface) {
+		// Decoded again if an output grew beyond its detail
+		struct background_target *targets;
+		int count = get_image_targets(state, image, &targets);
+		bool enough = true;
+		for (int i = 0; i < count && enough; ++i) {
+			enough = image_has_detail_for(image, targets[i].mode,
+					targets[i].width, targets[i].height);
+		}
+		free(targets);
+		if (enough) {
+			return;
+		}
+	}
+	submit_image_job(state, image, false);
+}
+
+/*
+ * In low memory mode, drops decoded images once every output using them has
+ * a frame. They are decoded again if a new size has to be rendered that is
+ * not in the pre-scaled cache.
+ */
+static void release_unused_images(struct swaybg_state *state) {
+	struct swaybg_image *image;
+	wl_list_for_each(image, &state->images, link) {
+		if (!image->surface) {
+			continue;
+		}
+		bool needed = false;
+		struct swaybg_output *output;
+		wl_list_for_each(output, &state->outputs, link) {
+			if (output->config && output->config->image == image &&
+					(!output->frame || output->image_pending)) {
+				needed = true;
+				break;
+			}
+		}
+		if (needed) {
+			continue;
+		}
+		size_t size = (size_t)cairo_image_surface_get_stride(image->surface) *
+			cairo_image_surface_get_height(image->surface);
+		swaybg_log(LOG_DEBUG, "Releasing decoded image %s (%zu KiB)",
+				image->path, size / 1024);
+		cairo_surface_destroy(image->surface);
+		image->surface = NULL;
+	}
+}
+
+static void unwatch_image(struct swaybg_image *image);
+
+static void destroy_swaybg_image(struct swaybg_image *image) {
+	unwatch_image(image);
+	wl_list_remove(&image->link);
+	if (image->surface) {
+		cairo_surface_destroy(image->surface);
+	}
+	free(image->path);
+	free(image);
+}
+
+static void destroy_scaled_image(struct swaybg_scaled_image *scaled) {
+	wl_list_remove(&scaled->link);
+	cairo_surface_destroy(scaled->surface);
+	free(scaled);
+}
+
+static void destroy_scaled_images(struct swaybg_output_config *config) {
+	struct swaybg_scaled_image *scaled, *tmp;
+	wl_list_for_each_safe(scaled, tmp, &config->scaled_images, link) {
+		destroy_scaled_image(scaled);
+	}
+}
+
+// Must be called whenever the appearance of config changes
+static void invalidate_config(struct swaybg_output_config *config) {
+	destroy_scaled_images(config);
+	config->generation++;
+}
+
+// Editors and generators tend to write a file in several steps
+#define RELOAD_DELAY_MS 250
+
+static void watch_image(struct swaybg_image *image) {
+	char *dir_path = strdup(image->path);
+	char *name_path = strdup(image->path);
+	if (!dir_path || !name_path) {
+		swaybg_log(LOG_ERROR, "Failed to allocate image watch");
+		goto out;
+	}
+	image->watch = inotify_add_watch(image->state->watch_fd, dirname(dir_path),
+			IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR);
+	if (image->watch == -1) {
+		swaybg_log_errno(LOG_ERROR, "Failed to watch %s", image->path);
+		goto out;
+	}
+	image->watch_name = strdup(basename(name_path));
+out:
+	free(dir_path);
+	free(name_path);
+}
+
+static void unwatch_image(struct swaybg_image *image) {
+	struct swaybg_state *state = image->state;
+	if (image->reload_timer) {
+		loop_remove_timer(state->loop, image->reload_timer);
+		image->reload_timer = NULL;
+	}
+	if (image->watch == -1) {
+		return;
+	}
+	bool shared = false;
+	struct swaybg_image *other;
+	wl_list_for_each(other, &state->images, link) {
+		if (other != image && other->watch == image->watch) {
+			shared = true;
+			break;
+		}
+	}
+	if (!shared) {
+		inotify_rm_watch(state->watch_fd, image->watch);
+	}
+	image->watch = -1;
+	free(image->watch_name);
+	image->watch_name = NULL;
+}
+
+static void schedule_image_reload(struct swaybg_image *image);
+
+static bool image_is_shown(struct swaybg_image *image) {
+	struct swaybg_output *output;
+	wl_list_for_each(output, &image->state->outputs, link) {
+		if (output->config && output->config->image == image) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * For changed images that are neither decoded nor shown. They are read from
+ * the file again anyway once needed, so only the frames pre-scaled from the
+ * old contents have to go.
+ */
+static void mark_image_stale(struct swaybg_image *image) {
+	struct swaybg_state *state = image->state;
+	image->load_failed = false;
+	struct swaybg_output_config *config;
+	wl_list_for_each(config, &state->configs, link) {
+		struct swaybg_scaled_image *scaled, *tmp;
+		wl_list_for_each_safe(scaled, tmp, &config->scaled_images, link) {
+			if (scaled->image == image) {
+				destroy_scaled_image(scaled);
+			}
+		}
+	}
+	// Scaled again if it is the next slide
+	prefetch_loaded_slide(state, image);
+}
+
+static void handle_reload_timer(void *data) {
+	struct swaybg_image *image = data;
+	image->reload_timer = NULL;
+	if (image->loading) {
+		// Only swap in a decode of the latest contents
+		schedule_image_reload(image);
+		return;
+	}
+	if (!image->surface && !image_is_shown(image)) {
+		swaybg_log(LOG_DEBUG, "Image %s changed, reading it once needed",
+				image->path);
+		mark_image_stale(image);
+		return;
+	}
+	submit_image_job(image->state, image, true);
+}
+
+static void schedule_image_reload(struct swaybg_image *image) {
+	struct loop *loop = image->state->loop;
+	if (image->reload_timer) {
+		loop_remove_timer(loop, image->reload_timer);
+	}
+	image->reload_timer = loop_add_timer(loop, RELOAD_DELAY_MS,
+			handle_reload_timer, image);
+}
+
+static void watch_in(int fd, short mask, void *data) {
+	struct swaybg_state *state = data;
+	char buf[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		const struct inotify_event *event;
+		for (char *ptr = buf; ptr < buf + len;
+				ptr += sizeof(struct inotify_event) + event->len) {
+			event = (const struct inotify_event *)ptr;
+			struct swaybg_image *image;
+			wl_list_for_each(image, &state->images, link) {
+				// After an overflow any of them might have changed
+				if ((event->mask & IN_Q_OVERFLOW) ||
+						(image->watch == event->wd && event->len &&
+						 image->watch_name &&
+						 strcmp(image->watch_name, event->name) == 0)) {
+					schedule_image_reload(image);
+				}
+			}
+		}
+	}
+	if (len == -1 && errno != EAGAIN && errno != EINTR) {
+		swaybg_log_errno(LOG_ERROR, "Failed to read inotify events");
+	}
+}
+
+static struct swaybg_scaled_image *find_scaled_image(
+		struct swaybg_output_config *config, struct swaybg_image *image,
+		int width, int height) {
+	struct swaybg_scaled_image *scaled;
+	wl_list_for_each(scaled, &config->scaled_images, link) {
+		if (scaled->image == image &&
+				scaled->width == width && scaled->height == height) {
+			return scaled;
+		}
+	}
+	return NULL;
+}
+
+// Takes ownership of surface
+static void cache_scaled_image(struct swaybg_output_config *config,
+		struct swaybg_image *image, cairo_surface_t *surface) {
+	struct swaybg_scaled_image *scaled =
+		calloc(1, sizeof(struct swaybg_scaled_image));
+	if (!scaled) {
+		cairo_surface_destroy(surface);
 		return;
 	}
-	cairo_t *cairo = output->current_buffer->cairo;
-	cairo_save(cairo);
-	cairo_set_operator(cairo, CAIRO_OPERATOR_CLEAR);
-	cairo_paint(cairo);
-	cairo_restore(cairo);
-	if (output->config->mode == BACKGROUND_MODE_SOLID_COLOR) {
-		cairo_set_source_u32(cairo, output->config->color);
+	scaled->image = image;
+	scaled->surface = surface;
+	scaled->width = cairo_image_surface_get_width(surface);
+	scaled->height = cairo_image_surface_get_height(surface);
+	wl_list_insert(&config->scaled_images, &scaled->link);
+	if (wl_list_length(&config->scaled_images) > SCALED_IMAGE_CACHE_SIZE) {
+		struct swaybg_scaled_image *lru = wl_container_of(
+				config->scaled_images.prev, lru, link);
+		destroy_scaled_image(lru);
+	}
+}
+
+struct store_scaled_job {
+	struct image_cache_key key;
+	cairo_surface_t *surface;
+};
+
+static void store_scaled_work(void *data) {
+	struct store_scaled_job *job = data;
+	image_cache_store(&job->key, job->surface);
+}
+
+static void store_scaled_done(void *data) {
+	struct store_scaled_job *job = data;
+	cairo_surface_destroy(job->surface);
+	free((char *)job->key.path);
+	free(job);
+}
+
+// Writes a scaled copy to the disk cache in the background
+static void store_scaled_image(struct swaybg_state *state,
+		const struct image_cache_key *key, cairo_surface_t *surface) {
+	struct store_scaled_job *job = calloc(1, sizeof(struct store_scaled_job));
+	if (!job) {
+		return;
+	}
+	job->key = *key;
+	job->key.path = strdup(key->path);
+	job->surface = cairo_surface_reference(surface);
+	if (!job->key.path || !worker_pool_submit(state->workers,
+			store_scaled_work, store_scaled_done, job)) {
+		store_scaled_done(job);
+	}
+}
+
+// Looks for a scaled copy of image in the disk cache and keeps it in memory
+static cairo_surface_t *load_scaled_image(struct swaybg_output_config *config,
+		struct swaybg_image *image, int width, int height) {
+	struct image_cache_key key = {
+		.path = image->path,
+		.width = width,
+		.height = height,
+		.mode = config->mode,
+		.color = config->color,
+	};
+	if (!image_cache_stat_source(&key)) {
+		return NULL;
+	}
+	cairo_surface_t *surface = image_cache_load(&key);
+	if (surface) {
+		cache_scaled_image(config, image, surface);
+	}
+	return surface;
+}
+
+/*
+ * Returns the background of config composed at the given buffer size, ready
+ * to be copied into a buffer as is, or NULL if it has not been composed yet.
+ * Frames are cached per config and on disk, so only the first render at each
+ * size has to scale the source image.
+ */
+static cairo_surface_t *get_scaled_image(struct swaybg_state *state,
+		struct swaybg_output_config *config, int width, int height) {
+	struct swaybg_scaled_image *scaled =
+		find_scaled_image(config, config->image, width, height);
+	if (scaled) {
+		wl_list_remove(&scaled->link);
+		wl_list_insert(&config->scaled_images, &scaled->link);
+		return scaled->surface;
+	}
+	return load_scaled_image(config, config->image, width, height);
+}
+
+struct compose_job {
+	struct swaybg_state *state;
+	struct swaybg_output_config *config;
+	uint32_t generation;
+	struct swaybg_image *image;
+	cairo_surface_t *source; // a reference, in case the image is released
+	struct background_image_info source_info;
+	enum background_mode mode;
+	uint32_t color;
+	int width, height;
+	cairo_surface_t *surface;
+	struct wl_list link; // struct swaybg_state::compose_jobs
+};
+
+static void compose_work(void *data) {
+	struct compose_job *job = data;
+	job->surface = compose_background(job->state->workers, job->source,
+			job->mode, job->color, job->width, job->height);
+}
+
+static void compose_done(void *data) {
+	struct compose_job *job = data;
+	struct swaybg_state *state = job->state;
+	struct swaybg_output_config *config = job->config;
+	wl_list_remove(&job->link);
+	// Useless if the config changed meanwhile
+	bool valid = config->generation == job->generation;
+	if (job->surface && valid && !find_scaled_image(config, job->image,
+			job->width, job->height)) {
+		cache_scaled_image(config, job->image, job->surface);
+		// Keyed by the file as it was decoded, which may have changed since
+		struct image_cache_key key = {
+			.path = job->image->path,
+			.mtime = job->source_info.mtime,
+			.file_size = job->source_info.file_size,
+			.width = job->width,
+			.height = job->height,
+			.mode = job->mode,
+			.color = job->color,
+		};
+		store_scaled_image(state, &key, job->surface);
+	} else if (job->surface) {
+		cairo_surface_destroy(job->surface);
+	} else if (valid) {
+		swaybg_log(LOG_ERROR, "Failed to compose %dx%d background of %s",
+				job->width, job->height, config->output);
+	}
+	cairo_surface_destroy(job->source);
+	bool failed = !job->surface && valid;
+	int width = job->width, height = job->height;
+	free(job);
+
+	if (!state->run_display) {
+		return;
+	}
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (output->config != config || !output->image_pending) {
+			continue;
+		}
+		int buffer_width, buffer_height;
+		get_buffer_size(output, &buffer_width, &buffer_height);
+		if (buffer_width == width && buffer_height == height) {
+			output->compose_failed = failed;
+		}
+		schedule_render(output);
+	}
+}
+
+/*
+ * Starts composing the background of config at the given buffer size in the
+ * background, unless that is already under way. Outputs that need it set
+ * image_pending and are rendered once it is done. Returns false if it could
+ * not be started.
+ */
+static bool submit_compose_job(struct swaybg_state *state,
+		struct swaybg_output_config *config, int width, int height) {
+	struct compose_job *job;
+	wl_list_for_each(job, &state->compose_jobs, link) {
+		if (job->config == config && job->generation == config->generation &&
+				job->width == width && job->height == height) {
+			return true;
+		}
+	}
+	job = calloc(1, sizeof(struct compose_job));
+	if (!job) {
+		swaybg_log(LOG_ERROR, "Failed to allocate compose job");
+		return false;
+	}
+	struct swaybg_image *image = config->image;
+	job->state = state;
+	job->config = config;
+	job->generation = config->generation;
+	job->image = image;
+	cairo_surface_flush(image->surface);
+	job->source = cairo_surface_reference(image->surface);
+	job->source_info = image->info;
+	job->mode = config->mode;
+	job->color = config->color;
+	job->width = width;
+	job->height = height;
+	wl_list_insert(&state->compose_jobs, &job->link);
+	if (!worker_pool_submit(state->workers, compose_work,
+			compose_done, job)) {
+		wl_list_remove(&job->link);
+		cairo_surface_destroy(job->source);
+		free(job);
+		return false;
+	}
+	return true;
+}
+
+static void record_render(struct swaybg_frame *frame, int64_t start) {
+	perf_record("render", start, (int64_t)frame->width * frame->height,
+			"\"mode\":\"%s\",\"width\":%u,\"height\":%u",
+			background_mode_name(frame->config->mode),
+			frame->width, frame->height);
+}
+
+static bool render_shared_frame(struct swaybg_state *state,
+		struct swaybg_frame *frame) {
+	struct swaybg_output_config *config = frame->config;
+	int64_t start = perf_start();
+	cairo_surface_t *scaled = NULL, *image = NULL;
+	if (config->mode != BACKGROUND_MODE_SOLID_COLOR && config->image) {
+		scaled = get_scaled_image(state, config,
+				frame->width, frame->height);
+		if (!scaled) {
+			// Images that failed to load leave only the background color
+			image = config->image->surface;
+		}
+	}
+	if (scaled) {
+		frame->opaque =
+			cairo_image_surface_get_format(scaled) == CAIRO_FORMAT_RGB24;
+	} else {
+		frame->opaque =
+			background_is_opaque(image, config->mode, config->color);
+	}
+
+	frame->current_buffer = get_single_buffer(state->shm,
+			frame->buffers, frame->width, frame->height,
+			frame->opaque ? WL_SHM_FORMAT_XRGB8888 : WL_SHM_FORMAT_ARGB8888);
+	if (!frame->current_buffer) {
+		return false;
+	}
+	if (scaled) {
+		cairo_image_surface_copy(frame->current_buffer->surface, scaled);
+		record_render(frame, start);
+		return true;
+	}
+
+	cairo_t *cairo = frame->current_buffer->cairo;
+	if (!frame->opaque) {
+		cairo_save(cairo);
+		cairo_set_operator(cairo, CAIRO_OPERATOR_CLEAR);
+		cairo_paint(cairo);
+		cairo_restore(cairo);
+	}
+	if (config->color) {
+		cairo_set_source_u32(cairo, config->color);
 		cairo_paint(cairo);
+	}
+	if (image) {
+		render_background_image(cairo, image, config->mode,
+				frame->width, frame->height);
+	}
+	record_render(frame, start);
+	return true;
+}
+
+static void destroy_frame(struct swaybg_frame *frame) {
+	wl_list_remove(&frame->link);
+	destroy_buffer(&frame->buffers[0]);
+	destroy_buffer(&frame->buffers[1]);
+	free(frame);
+}
+
+static void unref_frame(struct swaybg_frame *frame) {
+	if (frame && --frame->refs == 0) {
+		destroy_frame(frame);
+	}
+}
+
+/*
+ * Brings a frame of an older generation of its config up to date by only
+ * copying the tiles that changed, in place if its buffer is free again, or
+ * else into a new buffer that supersedes it. Outputs showing the frame then
+ * only need the changed tiles damaged. Returns false if the frame has to be
+ * rendered from scratch instead.
+ */
+static bool update_frame(struct swaybg_state *state,
+		struct swaybg_frame *frame) {
+	struct swaybg_output_config *config = frame->config;
+	struct pool_buffer *prev = frame->current_buffer;
+	int64_t start = perf_start();
+	if (config->mode == BACKGROUND_MODE_SOLID_COLOR || !config->image ||
+			!prev || !prev->buffer) {
+		return false;
+	}
+	cairo_surface_t *scaled = get_scaled_image(state, config,
+			frame->width, frame->height);
+	if (!scaled) {
+		return false;
+	}
+	uint32_t format =
+		cairo_image_surface_get_format(scaled) == CAIRO_FORMAT_RGB24 ?
+		WL_SHM_FORMAT_XRGB8888 : WL_SHM_FORMAT_ARGB8888;
+	if (format != prev->format) {
+		return false;
+	}
+
+	cairo_rectangle_int_t damage[MAX_DAMAGE_RECTS];
+	int damage_count = cairo_image_surface_diff(prev->surface, scaled,
+			DAMAGE_TILE_SIZE, damage, MAX_DAMAGE_RECTS);
+
+	struct pool_buffer *target = prev;
+	if (pool_buffer_is_free(prev)) {
+		for (int i = 0; i < damage_count; ++i) {
+			cairo_image_surface_copy_rect(target->surface, scaled, &damage[i]);
+		}
+		prev->attach_count = 0;
 	} else {
-		if (output->config->color) {
-			cairo_set_source_u32(cairo, output->config->color);
-			cairo_paint(cairo);
+		// Like a new render, so that the frame keeps a single buffer once
+		// the compositor lets go of the previous one
+		target = get_single_buffer(state->shm, frame->buffers,
+				frame->width, frame->height, format);
+		if (!target) {
+			return false;
 		}
-		render_background_image(cairo, output->config->image,
-				output->config->mode, buffer_width, buffer_height);
+		cairo_image_surface_copy(target->surface, scaled);
+	}
+
+	frame->current_buffer = target;
+	frame->generation = config->generation;
+	frame->serial++;
+	memcpy(frame->damage, damage, sizeof(cairo_rectangle_int_t) * damage_count);
+	frame->damage_count = damage_count;
+	int64_t damaged = 0;
+	for (int i = 0; i < damage_count; ++i) {
+		damaged += (int64_t)damage[i].width * damage[i].height;
 	}
+	perf_record("update", start, (int64_t)frame->width * frame->height,
+			"\"width\":%u,\"height\":%u,\"damage_rects\":%d,"
+			"\"damaged_pixels\":%lld", frame->width, frame->height,
+			damage_count, (long long)damaged);
+	swaybg_log(LOG_DEBUG, "Updated %ux%u frame of %s in place, "
+			"%d damage rectangle(s)", frame->width, frame->height,
+			config->output, damage_count);
+	return true;
+}
 
-	wl_surface_set_buffer_scale(output->surface, output->scale);
-	wl_surface_attach(output->surface, output->current_buffer->buffer, 0, 0);
-	wl_surface_damage_buffer(output->surface, 0, 0, INT32_MAX, INT32_MAX);
+/*
+ * Returns a referenced frame showing config at the given buffer size. Outputs
+ * with identical geometry and config get the same frame, so it is rendered
+ * and allocated only once.
+ */
+static struct swaybg_frame *get_frame(struct swaybg_state *state,
+		struct swaybg_output_config *config, uint32_t width, uint32_t height) {
+	struct swaybg_frame *frame;
+	wl_list_for_each(frame, &state->frames, link) {
+		if (frame->config == config &&
+				frame->generation == config->generation &&
+				frame->width == width && frame->height == height) {
+			frame->refs++;
+			return frame;
+		}
+	}
+	// After a change of the config, redraw only what changed
+	wl_list_for_each(frame, &state->frames, link) {
+		if (frame->config == config &&
+				frame->width == width && frame->height == height) {
+			if (update_frame(state, frame)) {
+				frame->refs++;
+				return frame;
+			}
+			break;
+		}
+	}
+
+	frame = calloc(1, sizeof(struct swaybg_frame));
+	if (!frame) {
+		swaybg_log(LOG_ERROR, "Failed to allocate frame");
+		return NULL;
+	}
+	frame->config = config;
+	frame->generation = config->generation;
+	frame->width = width;
+	frame->height = height;
+	frame->refs = 1;
+	wl_list_insert(&state->frames, &frame->link);
+	if (!render_shared_frame(state, frame)) {
+		destroy_frame(frame);
+		return NULL;
+	}
+	return frame;
+}
+
+/*
+ * Whether config can be shown at the given buffer size without scaling its
+ * image, i.e. a frame or a pre-scaled copy of that size exists. A copy found
+ * in the disk cache is loaded on the way.
+ */
+static bool has_scaled_image(struct swaybg_state *state,
+		struct swaybg_output_config *config, uint32_t width, uint32_t height) {
+	struct swaybg_frame *frame;
+	wl_list_for_each(frame, &state->frames, link) {
+		if (frame->config == config &&
+				frame->generation == config->generation &&
+				frame->width == width && frame->height == height) {
+			return true;
+		}
+	}
+	return find_scaled_image(config, config->image, width, height) ||
+		load_scaled_image(config, config->image, width, height);
+}
+
+// Whether the image of config has to be decoded before it can be shown
+static bool needs_decoded_image(struct swaybg_state *state,
+		struct swaybg_output_config *config, uint32_t width, uint32_t height) {
+	struct swaybg_image *image = config->image;
+	if (config->mode == BACKGROUND_MODE_SOLID_COLOR || !image ||
+			image->load_failed || (image->surface &&
+			 image_has_detail_for(image, config->mode, width, height))) {
+		return false;
+	}
+	return !has_scaled_image(state, config, width, height);
+}
+
+// Whether the decoded image of config has yet to be composed at that size
+static bool needs_composed_image(struct swaybg_state *state,
+		struct swaybg_output_config *config, uint32_t width, uint32_t height) {
+	return config->mode != BACKGROUND_MODE_SOLID_COLOR && config->image &&
+		config->image->surface &&
+		!has_scaled_image(state, config, width, height);
+}
+
+static bool config_uses_image(struct swaybg_output_config *config,
+		struct swaybg_image *image) {
+	if (config->image == image) {
+		return true;
+	}
+	if (config->slideshow) {
+		for (size_t i = 0; i < config->slideshow->count; ++i) {
+			if (config->slideshow->images[i] == image) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void destroy_slideshow(struct swaybg_slideshow *slideshow) {
+	if (!slideshow) {
+		return;
+	}
+	if (slideshow->timer) {
+		loop_remove_timer(slideshow->state->loop, slideshow->timer);
+	}
+	free(slideshow->images);
+	free(slideshow);
+}
+
+// Skips images that failed to load, may return the current one
+static struct swaybg_image *get_next_slide(struct swaybg_slideshow *slideshow,
+		size_t *index) {
+	for (size_t i = 1; i <= slideshow->count; ++i) {
+		size_t next = (slideshow->index + i) % slideshow->count;
+		if (!slideshow->images[next]->load_failed) {
+			*index = next;
+			return slideshow->images[next];
+		}
+	}
+	return NULL;
+}
+
+struct prefetch_size {
+	int width, height;
+	cairo_surface_t *surface;
+};
+
+struct prefetch_job {
+	struct swaybg_state *state;
+	struct swaybg_output_config *config;
+	uint32_t slideshow_id;
+	uint32_t generation;
+	struct swaybg_image *image;
+	cairo_surface_t *source; // a reference, in case the image is released
+	struct background_image_info source_info;
+	enum background_mode mode;
+	uint32_t color;
+	struct prefetch_size *sizes;
+	int count;
+	bool finished;
+};
+
+static void prefetch_work(void *data) {
+	struct prefetch_job *job = data;
+	for (int i = 0; i < job->count; ++i) {
+		job->sizes[i].surface = compose_background(job->state->workers,
+				job->source, job->mode, job->color,
+				job->sizes[i].width, job->sizes[i].height);
+	}
+	job->finished = true;
+}
+
+static void prefetch_next_slide(struct swaybg_slideshow *slideshow);
+
+static void prefetch_done(void *data) {
+	struct prefetch_job *job = data;
+	struct swaybg_state *state = job->state;
+	struct swaybg_output_config *config = job->config;
+	bool same_slideshow = config->slideshow &&
+		config->slideshow->id == job->slideshow_id;
+	if (same_slideshow) {
+		config->slideshow->prefetching = false;
+	}
+	// Useless if the slideshow moved on or the config changed meanwhile
+	bool valid = job->finished && same_slideshow &&
+		config->generation == job->generation;
+	for (int i = 0; i < job->count; ++i) {
+		cairo_surface_t *surface = job->sizes[i].surface;
+		if (!surface) {
+			continue;
+		}
+		if (valid && !find_scaled_image(config, job->image,
+				job->sizes[i].width, job->sizes[i].height)) {
+			cache_scaled_image(config, job->image, surface);
+			struct image_cache_key key = {
+				.path = job->image->path,
+				.mtime = job->source_info.mtime,
+				.file_size = job->source_info.file_size,
+				.width = job->sizes[i].width,
+				.height = job->sizes[i].height,
+				.mode = job->mode,
+				.color = job->color,
+			};
+			store_scaled_image(state, &key, surface);
+		} else {
+			cairo_surface_destroy(surface);
+		}
+	}
+	cairo_surface_destroy(job->source);
+	free(job->sizes);
+	free(job);
+
+	if (valid && state->run_display) {
+		// Outputs may have changed size in the meantime
+		prefetch_next_slide(config->slideshow);
+		if (state->low_memory) {
+			release_unused_images(state);
+		}
+	}
+}
+
+/*
+ * Scales the next slide to the buffer size of every output showing the
+ * slideshow, decoding it first if necessary.
+ */
+static void prefetch_next_slide(struct swaybg_slideshow *slideshow) {
+	struct swaybg_state *state = slideshow->state;
+	struct swaybg_output_config *config = slideshow->config;
+	size_t index;
+	struct swaybg_image *next = get_next_slide(slideshow, &index);
+	if (slideshow->prefetching || !next || next == config->image ||
+			config->mode == BACKGROUND_MODE_SOLID_COLOR) {
+		return;
+	}
+
+	struct prefetch_size *sizes =
+		calloc(wl_list_length(&state->outputs), sizeof(struct prefetch_size));
+	if (!sizes) {
+		return;
+	}
+	int count = 0;
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (output->config != config || !output->frame) {
+			continue;
+		}
+		int width, height;
+		get_buffer_size(output, &width, &height);
+		bool seen = find_scaled_image(config, next, width, height) ||
+			load_scaled_image(config, next, width, height);
+		for (int i = 0; i < count && !seen; ++i) {
+			seen = sizes[i].width == width && sizes[i].height == height;
+		}
+		if (!seen) {
+			sizes[count].width = width;
+			sizes[count].height = height;
+			++count;
+		}
+	}
+	if (count == 0) {
+		free(sizes);
+		return;
+	}
+	bool decoded = next->surface;
+	for (int i = 0; i < count && decoded; ++i) {
+		decoded = image_has_detail_for(next, config->mode,
+				sizes[i].width, sizes[i].height);
+	}
+	if (!decoded) {
+		// Continued by prefetch_loaded_slide
+		free(sizes);
+		load_swaybg_image(state, next);
+		return;
+	}
+
+	struct prefetch_job *job = calloc(1, sizeof(struct prefetch_job));
+	if (!job) {
+		free(sizes);
+		return;
+	}
+	job->state = state;
+	job->config = config;
+	job->slideshow_id = slideshow->id;
+	job->generation = config->generation;
+	job->image = next;
+	cairo_surface_flush(next->surface);
+	job->source = cairo_surface_reference(next->surface);
+	job->source_info = next->info;
+	job->mode = config->mode;
+	job->color = config->color;
+	job->sizes = sizes;
+	job->count = count;
+	swaybg_log(LOG_DEBUG, "Prefetching %s for %d output size(s)",
+			next->path, count);
+	slideshow->prefetching = true;
+	if (!worker_pool_submit(state->workers, prefetch_work,
+			prefetch_done, job)) {
+		slideshow->prefetching = false;
+		cairo_surface_destroy(job->source);
+		free(sizes);
+		free(job);
+	}
+}
+
+static void prefetch_loaded_slide(struct swaybg_state *state,
+		struct swaybg_image *image) {
+	struct swaybg_output_config *config;
+	wl_list_for_each(config, &state->configs, link) {
+		size_t index;
+		if (config->slideshow &&
+				get_next_slide(config->slideshow, &index) == image) {
+			prefetch_next_slide(config->slideshow);
+		}
+	}
+}
+
+static void show_next_slide(void *data);
+
+static void schedule_next_slide(struct swaybg_slideshow *slideshow) {
+	int interval = slideshow->config->interval ?
+		slideshow->config->interval : DEFAULT_SLIDE_INTERVAL;
+	slideshow->timer = loop_add_timer(slideshow->state->loop,
+			interval * 1000, show_next_slide, slideshow);
+}
+
+static void show_next_slide(void *data) {
+	struct swaybg_slideshow *slideshow = data;
+	struct swaybg_state *state = slideshow->state;
+	struct swaybg_output_config *config = slideshow->config;
+	slideshow->timer = NULL;
+
+	size_t index;
+	struct swaybg_image *next = get_next_slide(slideshow, &index);
+	struct swaybg_image *prev = config->image;
+	if (next && next != prev) {
+		swaybg_log(LOG_DEBUG, "Showing %s on %s", next->path, config->output);
+		config->image = next;
+		slideshow->index = index;
+		config->generation++;
+		// Keep memory at about the current and the next slide
+		struct swaybg_scaled_image *scaled, *tmp;
+		wl_list_for_each_safe(scaled, tmp, &config->scaled_images, link) {
+			if (scaled->image != next) {
+				destroy_scaled_image(scaled);
+			}
+		}
+		bool shown_elsewhere = false;
+		struct swaybg_output_config *other;
+		wl_list_for_each(other, &state->configs, link) {
+			shown_elsewhere |= other->image == prev;
+		}
+		if (!shown_elsewhere && prev->surface) {
+			cairo_surface_destroy(prev->surface);
+			prev->surface = NULL;
+		}
+
+		struct swaybg_output *output;
+		wl_list_for_each(output, &state->outputs, link) {
+			if (output->config == config && output->frame) {
+				schedule_render(output);
+			}
+		}
+	}
+	// Normally done by render_frame, unless no output shows the slideshow
+	if (!slideshow->timer) {
+		schedule_next_slide(slideshow);
+	}
+}
+
+static void render_frame(struct swaybg_output *output) {
+	// Compositors resend the same configure on many occasions, acking it
+	// is all that is needed then
+	struct swaybg_output_config *config = output->config;
+	if (output->frame && output->committed.config == config &&
+			output->committed.generation == config->generation &&
+			output->committed.width == output->width &&
+			output->committed.height == output->height &&
+			output->committed.scale == get_output_scale(output)) {
+		output->stats.unchanged++;
+		return;
+	}
+	output->stats.renders++;
+	int buffer_width, buffer_height;
+	get_buffer_size(output, &buffer_width, &buffer_height);
+	// A solid color only needs a single pixel when the compositor can scale
+	// it up to the output size for us
+	bool solid_color = output->config->mode == BACKGROUND_MODE_SOLID_COLOR &&
+		output->state->viewporter;
+	if (solid_color) {
+		buffer_width = buffer_height = 1;
+	}
+	// Buffers at fractional scales are sized in physical pixels and mapped
+	// onto the surface by the viewport
+	bool use_viewport = solid_color || output->preferred_scale;
+	if (needs_decoded_image(output->state, output->config,
+			buffer_width, buffer_height)) {
+		// load_image_done renders the output again
+		output->image_pending = true;
+		load_swaybg_image(output->state, output->config->image);
+		return;
+	}
+	if (!output->compose_failed && needs_composed_image(output->state,
+			output->config, buffer_width, buffer_height) &&
+			submit_compose_job(output->state, output->config,
+				buffer_width, buffer_height)) {
+		// compose_done renders the output again
+		output->image_pending = true;
+		return;
+	}
+	output->image_pending = false;
+	output->compose_failed = false;
+
+	int64_t start = perf_start();
+	struct swaybg_frame *frame = get_frame(output->state, output->config,
+			buffer_width, buffer_height);
+	if (!frame) {
+		return;
+	}
+	// Outputs that showed the previous contents of an updated frame only
+	// need the parts that changed
+	bool partial = frame == output->frame &&
+		output->frame_serial + 1 == frame->serial;
+	if (frame == output->frame && output->frame_serial == frame->serial) {
+		output->stats.redundant_commits++;
+	}
+	// Acquire the new frame first, so that an unchanged one is kept alive
+	unref_frame(output->frame);
+	output->frame = frame;
+	output->frame_serial = frame->serial;
+
+	if (use_viewport) {
+		if (!output->viewport) {
+			output->viewport = wp_viewporter_get_viewport(
+					output->state->viewporter, output->surface);
+		}
+		wp_viewport_set_destination(output->viewport,
+				output->width, output->height);
+		wl_surface_set_buffer_scale(output->surface, 1);
+	} else {
+		if (output->viewport) {
+			// Takes effect with the commit below
+			wp_viewport_destroy(output->viewport);
+			output->viewport = NULL;
+		}
+		wl_surface_set_buffer_scale(output->surface, output->scale);
+	}
+
+	// Lets the compositor skip blending the layers below the background
+	if (frame->opaque) {
+		struct wl_region *opaque_region =
+			wl_compositor_create_region(output->state->compositor);
+		wl_region_add(opaque_region, 0, 0, output->width, output->height);
+		wl_surface_set_opaque_region(output->surface, opaque_region);
+		wl_region_destroy(opaque_region);
+	} else {
+		wl_surface_set_opaque_region(output->surface, NULL);
+	}
+	wl_surface_attach(output->surface, frame->current_buffer->buffer, 0, 0);
+	frame->current_buffer->busy = true;
+	frame->current_buffer->attach_count++;
+	if (partial) {
+		for (int i = 0; i < frame->damage_count; ++i) {
+			wl_surface_damage_buffer(output->surface,
+					frame->damage[i].x, frame->damage[i].y,
+					frame->damage[i].width, frame->damage[i].height);
+			output->stats.damaged_pixels +=
+				(uint64_t)frame->damage[i].width * frame->damage[i].height;
+		}
+		output->stats.damage_rects += frame->damage_count;
+	} else {
+		wl_surface_damage_buffer(output->surface, 0, 0, INT32_MAX, INT32_MAX);
+		output->stats.damaged_pixels +=
+			(uint64_t)buffer_width * buffer_height;
+		output->stats.damage_rects++;
+	}
 	wl_surface_commit(output->surface);
+	output->stats.commits++;
+	output->committed.config = output->config;
+	output->committed.generation = output->config->generation;
+	output->committed.width = output->width;
+	output->committed.height = output->height;
+	output->committed.scale = get_output_scale(output);
+	perf_record("frame", start, (int64_t)buffer_width * buffer_height,
+			"\"width\":%d,\"height\":%d,\"partial\":%s",
+			buffer_width, buffer_height, partial ? "true" : "false");
+
+	struct swaybg_slideshow *slideshow = output->config->slideshow;
+	if (slideshow) {
+		if (!slideshow->timer) {
+			schedule_next_slide(slideshow);
+		}
+		prefetch_next_slide(slideshow);
+	}
+	if (output->state->low_memory) {
+		release_unused_images(output->state);
+	}
+}
+
+/*
+ * Configure, scale and other events often arrive in quick succession, e.g.
+ * when an output is plugged in. Rendering waits until all events that are
+ * already queued have been handled, so that the output is drawn once in its
+ * settled state.
+ */
+static void schedule_render(struct swaybg_output *output) {
+	output->stats.renders_requested++;
+	output->dirty = true;
+}
+
+static void render_dirty_outputs(struct swaybg_state *state) {
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (!output->dirty) {
+			continue;
+		}
+		output->dirty = false;
+		if (output->layer_surface && output->width && output->height) {
+			render_frame(output);
+		}
+	}
 }
 
 static void destroy_swaybg_output_config(struct swaybg_output_config *config) {
@@ -127,6 +1514,8 @@ static void destroy_swaybg_output_config(struct swaybg_output_config *config) {
 		return;
 	}
 	wl_list_remove(&config->link);
+	destroy_scaled_images(config);
+	destroy_slideshow(config->slideshow);
 	free(config->output);
 	free(config);
 }
@@ -136,6 +1525,21 @@ static void destroy_swaybg_output(struct swaybg_output *output) {
 		return;
 	}
 	wl_list_remove(&output->link);
+	swaybg_log(LOG_DEBUG, "Output %s: %u render(s) for %u request(s), "
+			"%u skipped as unchanged, %u commit(s), %u redundant, "
+			"%u damage rectangle(s) covering %llu pixels",
+			output->name ? output->name : "(unnamed)",
+			output->stats.renders, output->stats.renders_requested,
+			output->stats.unchanged,
+			output->stats.commits, output->stats.redundant_commits,
+			output->stats.damage_rects,
+			(unsigned long long)output->stats.damaged_pixels);
+	if (output->viewport != NULL) {
+		wp_viewport_destroy(output->viewport);
+	}
+	if (output->fractional_scale != NULL) {
+		wp_fractional_scale_v1_destroy(output->fractional_scale);
+	}
 	if (output->layer_surface != NULL) {
 		zwlr_layer_surface_v1_destroy(output->layer_surface);
 	}
@@ -144,8 +1548,7 @@ static void destroy_swaybg_output(struct swaybg_output *output) {
 	}
 	zxdg_output_v1_destroy(output->xdg_output);
 	wl_output_destroy(output->wl_output);
-	destroy_buffer(&output->buffers[0]);
-	destroy_buffer(&output->buffers[1]);
+	unref_frame(output->frame);
 	free(output->name);
 	free(output->identifier);
 	free(output);
@@ -158,7 +1561,7 @@ static void layer_surface_configure(void *data,
 	output->width = width;
 	output->height = height;
 	zwlr_layer_surface_v1_ack_configure(surface, serial);
-	render_frame(output);
+	schedule_render(output);
 }
 
 static void layer_surface_closed(void *data,
@@ -192,9 +1595,9 @@ static void output_done(void *data, struct wl_output *output) {
 static void output_scale(void *data, struct wl_output *wl_output,
 		int32_t scale) {
 	struct swaybg_output *output = data;
-	output->scale = scale;
-	if (output->state->run_display && output->width > 0 && output->height > 0) {
-		render_frame(output);
+	if (output->scale != scale) {
+		output->scale = scale;
+		schedule_render(output);
 	}
 }
 
@@ -260,6 +1663,19 @@ static void xdg_output_handle_description(void *data,
 	}
 }
 
+static void fractional_scale_preferred_scale(void *data,
+		struct wp_fractional_scale_v1 *fractional_scale, uint32_t scale) {
+	struct swaybg_output *output = data;
+	if (output->preferred_scale != scale) {
+		output->preferred_scale = scale;
+		schedule_render(output);
+	}
+}
+
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+	.preferred_scale = fractional_scale_preferred_scale,
+};
+
 static void create_layer_surface(struct swaybg_output *output) {
 	output->surface = wl_compositor_create_surface(output->state->compositor);
 	assert(output->surface);
@@ -285,19 +1701,36 @@ static void create_layer_surface(struct swaybg_output *output) {
 	zwlr_layer_surface_v1_set_exclusive_zone(output->layer_surface, -1);
 	zwlr_layer_surface_v1_add_listener(output->layer_surface,
 			&layer_surface_listener, output);
+
+	// Needs the viewport to map buffers of any size onto the surface
+	if (output->state->fractional_scale_manager &&
+			output->state->viewporter) {
+		output->fractional_scale =
+			wp_fractional_scale_manager_v1_get_fractional_scale(
+				output->state->fractional_scale_manager, output->surface);
+		wp_fractional_scale_v1_add_listener(output->fractional_scale,
+				&fractional_scale_listener, output);
+	}
 	wl_surface_commit(output->surface);
 }
 
 static void xdg_output_handle_done(void *data,
 		struct zxdg_output_v1 *xdg_output) {
 	struct swaybg_output *output = data;
-	if (!output->config) {
+	if (!output->config && output->state->control_path) {
+		swaybg_log(LOG_DEBUG, "Could not find config for output %s (%s), "
+				"waiting for control commands",
+				output->name, output->identifier);
+		output->unconfigured = true;
+	} else if (!output->config) {
 		swaybg_log(LOG_DEBUG, "Could not find config for output %s (%s)",
 				output->name, output->identifier);
 		destroy_swaybg_output(output);
 	} else if (!output->layer_surface) {
 		swaybg_log(LOG_DEBUG, "Found config %s for output %s (%s)",
 				output->config->output, output->name, output->identifier);
+		// The image is only decoded once render_frame knows the buffer
+		// size, since the disk cache may already have it scaled to that
 		create_layer_surface(output);
 	}
 }
@@ -339,6 +1772,13 @@ static void handle_global(void *data, struct wl_registry *registry,
 	} else if (strcmp(interface, zxdg_output_manager_v1_interface.name) == 0) {
 		state->xdg_output_manager = wl_registry_bind(registry, name,
 			&zxdg_output_manager_v1_interface, 2);
+	} else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+		state->viewporter = wl_registry_bind(registry, name,
+			&wp_viewporter_interface, 1);
+	} else if (strcmp(interface,
+			wp_fractional_scale_manager_v1_interface.name) == 0) {
+		state->fractional_scale_manager = wl_registry_bind(registry, name,
+			&wp_fractional_scale_manager_v1_interface, 1);
 	}
 }
 
@@ -368,15 +1808,25 @@ static bool store_swaybg_output_config(struct swaybg_state *state,
 		if (strcmp(config->output, oc->output) == 0) {
 			// Merge on top
 			if (config->image) {
-				free(oc->image);
 				oc->image = config->image;
-				config->image = NULL;
+				destroy_slideshow(oc->slideshow);
+				oc->slideshow = config->slideshow;
+				if (oc->slideshow) {
+					oc->slideshow->config = oc;
+				}
+				config->slideshow = NULL;
+				invalidate_config(oc);
+			}
+			if (config->interval) {
+				oc->interval = config->interval;
 			}
 			if (config->color) {
 				oc->color = config->color;
+				invalidate_config(oc);
 			}
 			if (config->mode != BACKGROUND_MODE_INVALID) {
 				oc->mode = config->mode;
+				invalidate_config(oc);
 			}
 			return false;
 		}
@@ -386,15 +1836,100 @@ static bool store_swaybg_output_config(struct swaybg_state *state,
 	return true;
 }
 
+static bool add_config_image(struct swaybg_state *state,
+		struct swaybg_output_config *config, struct swaybg_image *image) {
+	if (!config->image) {
+		config->image = image;
+		return true;
+	}
+	struct swaybg_slideshow *slideshow = config->slideshow;
+	if (!slideshow) {
+		slideshow = calloc(1, sizeof(struct swaybg_slideshow));
+		if (!slideshow) {
+			return false;
+		}
+		slideshow->state = state;
+		slideshow->config = config;
+		slideshow->id = ++state->next_slideshow_id;
+	}
+	size_t count = slideshow->count ? slideshow->count : 1;
+	struct swaybg_image **images = realloc(slideshow->images,
+			(count + 1) * sizeof(struct swaybg_image *));
+	if (!images) {
+		if (!config->slideshow) {
+			free(slideshow);
+		}
+		return false;
+	}
+	images[0] = config->image;
+	images[count] = image;
+	slideshow->images = images;
+	slideshow->count = count + 1;
+	config->slideshow = slideshow;
+	return true;
+}
+
+static int filter_slide(const struct dirent *entry) {
+	return entry->d_name[0] != '.';
+}
+
+/*
+ * Adds path to the images of config. A directory adds all files in it, in
+ * alphabetical order, and more than one image makes a slideshow.
+ */
+static bool add_config_images(struct swaybg_state *state,
+		struct swaybg_output_config *config, const char *path) {
+	struct stat st;
+	if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		// Missing files are reported once they are loaded
+		struct swaybg_image *image = get_swaybg_image(state, path);
+		return image && add_config_image(state, config, image);
+	}
+
+	struct dirent **entries;
+	int n = scandir(path, &entries, filter_slide, alphasort);
+	if (n == -1) {
+		swaybg_log_errno(LOG_ERROR, "Failed to read directory %s", path);
+		return false;
+	}
+	int added = 0;
+	for (int i = 0; i < n; ++i) {
+		size_t len = strlen(path) + strlen(entries[i]->d_name) + 2;
+		char *file = malloc(len);
+		if (file) {
+			snprintf(file, len, "%s/%s", path, entries[i]->d_name);
+			if (stat(file, &st) == 0 && S_ISREG(st.st_mode)) {
+				struct swaybg_image *image = get_swaybg_image(state, file);
+				if (image && add_config_image(state, config, image)) {
+					++added;
+				}
+			}
+			free(file);
+		}
+		free(entries[i]);
+	}
+	free(entries);
+	if (added == 0) {
+		swaybg_log(LOG_ERROR, "No images found in %s", path);
+		return false;
+	}
+	return true;
+}
+
 static void parse_command_line(int argc, char **argv,
 		struct swaybg_state *state) {
 	static struct option long_options[] = {
 		{"color", required_argument, NULL, 'c'},
 		{"help", no_argument, NULL, 'h'},
 		{"image", required_argument, NULL, 'i'},
+		{"interval", required_argument, NULL, 't'},
+		{"low-memory", no_argument, NULL, 'l'},
 		{"mode", required_argument, NULL, 'm'},
+		{"no-cache", no_argument, NULL, 'n'},
 		{"output", required_argument, NULL, 'o'},
+		{"socket", required_argument, NULL, 's'},
 		{"version", no_argument, NULL, 'v'},
+		{"watch", no_argument, NULL, 'w'},
 		{0, 0, 0, 0}
 	};
 
@@ -403,10 +1938,15 @@ static void parse_command_line(int argc, char **argv,
 		"\n"
 		"  -c, --color            Set the background color.\n"
 		"  -h, --help             Show help message and quit.\n"
-		"  -i, --image            Set the image to display.\n"
+		"  -i, --image            Set the image or directory of images to display.\n"
+		"  -l, --low-memory       Free decoded images once they are shown.\n"
 		"  -m, --mode             Set the mode to use for the image.\n"
+		"  -n, --no-cache         Do not keep scaled images on disk.\n"
 		"  -o, --output           Set the output to operate on or * for all.\n"
+		"  -s, --socket           Accept configuration changes on this socket.\n"
+		"  -t, --interval         Set the seconds between images of a slideshow.\n"
 		"  -v, --version          Show the version number and quit.\n"
+		"  -w, --watch            Reload images when their files change.\n"
 		"\n"
 		"Background Modes:\n"
 		"  stretch, fit, fill, center, tile, or solid_color\n";
@@ -414,12 +1954,13 @@ static void parse_command_line(int argc, char **argv,
 	struct swaybg_output_config *config = calloc(sizeof(struct swaybg_output_config), 1);
 	config->output = strdup("*");
 	config->mode = BACKGROUND_MODE_INVALID;
+	wl_list_init(&config->scaled_images);
 	wl_list_init(&config->link); // init for safe removal
 
 	int c;
 	while (1) {
 		int option_index = 0;
-		c = getopt_long(argc, argv, "c:hi:m:o:v", long_options, &option_index);
+		c = getopt_long(argc, argv, "c:hi:lm:no:s:t:vw", long_options, &option_index);
 		if (c == -1) {
 			break;
 		}
@@ -432,11 +1973,14 @@ static void parse_command_line(int argc, char **argv,
 			config->color = parse_color(optarg);
 			break;
 		case 'i':  // image
-			free(config->image);
-			config->image = load_background_image(optarg);
-			if (!config->image) {
-				swaybg_log(LOG_ERROR, "Failed to load image: %s", optarg);
-			}
+			// Decoded once an output actually needs it
+			add_config_images(state, config, optarg);
+			break;
+		case 'l':  // low-memory
+			state->low_memory = true;
+			break;
+		case 'n':  // no-cache
+			state->no_cache = true;
 			break;
 		case 'm':  // mode
 			config->mode = parse_background_mode(optarg);
@@ -452,8 +1996,25 @@ static void parse_command_line(int argc, char **argv,
 			config = calloc(sizeof(struct swaybg_output_config), 1);
 			config->output = strdup(optarg);
 			config->mode = BACKGROUND_MODE_INVALID;
+			wl_list_init(&config->scaled_images);
 			wl_list_init(&config->link);  // init for safe removal
 			break;
+		case 's':  // socket
+			state->control_path = optarg;
+			break;
+		case 't': {  // interval
+			char *end;
+			long interval = strtol(optarg, &end, 10);
+			if (*end || interval <= 0 || interval > INT32_MAX / 1000) {
+				swaybg_log(LOG_ERROR, "Invalid interval: %s", optarg);
+				continue;
+			}
+			config->interval = interval;
+			break;
+		}
+		case 'w':  // watch
+			state->watch_images = true;
+			break;
 		case 'v':  // version
 			fprintf(stdout, "swaybg version " SWAYBG_VERSION "\n");
 			exit(EXIT_SUCCESS);
@@ -496,14 +2057,243 @@ static void parse_command_line(int argc, char **argv,
 	}
 }
 
+static struct swaybg_output_config *match_output_config(
+		struct swaybg_state *state, struct swaybg_output *output) {
+	struct swaybg_output_config *config, *by_name = NULL, *wildcard = NULL;
+	wl_list_for_each(config, &state->configs, link) {
+		if (output->identifier &&
+				strcmp(config->output, output->identifier) == 0) {
+			return config;
+		} else if (output->name && !by_name &&
+				strcmp(config->output, output->name) == 0) {
+			by_name = config;
+		} else if (!wildcard && strcmp(config->output, "*") == 0) {
+			wildcard = config;
+		}
+	}
+	return by_name ? by_name : wildcard;
+}
+
+/*
+ * Handles one line of the control protocol:
+ *   <output> image <path>
+ *   <output> mode <mode>
+ *   <output> color <[#]rrggbb[aa]>
+ * Changes are applied to outputs once the whole batch has been read.
+ */
+static void handle_control_command(void *data, struct control_client *client,
+		char *line) {
+	struct swaybg_state *state = data;
+	char *saveptr;
+	char *name = strtok_r(line, " \t", &saveptr);
+	char *key = strtok_r(NULL, " \t", &saveptr);
+	// The rest of the line, so that image paths may contain spaces
+	char *value = strtok_r(NULL, "", &saveptr);
+	if (value) {
+		value += strspn(value, " \t");
+	}
+	if (!name || !key || !value || !*value) {
+		control_client_reply(client, "error: expected <output> <key> <value>");
+		return;
+	}
+
+	struct swaybg_output_config *config =
+		calloc(1, sizeof(struct swaybg_output_config));
+	if (!config) {
+		control_client_reply(client, "error: out of memory");
+		return;
+	}
+	config->output = strdup(name);
+	config->mode = BACKGROUND_MODE_INVALID;
+	wl_list_init(&config->scaled_images);
+	wl_list_init(&config->link);
+
+	if (strcmp(key, "image") == 0) {
+		add_config_images(state, config, value);
+		if (config->image) {
+			// Allow retrying after the file has been fixed
+			config->image->load_failed = false;
+		}
+	} else if (strcmp(key, "mode") == 0) {
+		config->mode = parse_background_mode(value);
+	} else if (strcmp(key, "color") == 0 && is_valid_color(value)) {
+		config->color = parse_color(value);
+	}
+	if (!config->image && !config->color &&
+			config->mode == BACKGROUND_MODE_INVALID) {
+		control_client_reply(client, "error: invalid %s: %s", key, value);
+		destroy_swaybg_output_config(config);
+		return;
+	}
+
+	if (!store_swaybg_output_config(state, config)) {
+		destroy_swaybg_output_config(config);
+	} else if (!config->image && !config->color) {
+		control_client_reply(client,
+				"error: set an image or color for %s first", name);
+		destroy_swaybg_output_config(config);
+		return;
+	} else if (config->mode == BACKGROUND_MODE_INVALID) {
+		config->mode = config->image
+			? BACKGROUND_MODE_STRETCH
+			: BACKGROUND_MODE_SOLID_COLOR;
+	}
+	state->configs_changed = true;
+	control_client_reply(client, "ok");
+}
+
+/*
+ * Applies the configuration changes of a batch of control commands. Only
+ * outputs whose configuration actually changed are rendered again; frames of
+ * the others stay shared and untouched.
+ */
+static void handle_control_batch_done(void *data) {
+	struct swaybg_state *state = data;
+	if (!state->configs_changed) {
+		return;
+	}
+	state->configs_changed = false;
+
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		// Outputs still waiting for xdg-output are matched once it is done
+		if (!output->layer_surface && !output->unconfigured) {
+			continue;
+		}
+		struct swaybg_output_config *config =
+			match_output_config(state, output);
+		if (!config) {
+			continue;
+		}
+		if (output->unconfigured) {
+			swaybg_log(LOG_DEBUG, "Found config %s for output %s (%s)",
+					config->output, output->name, output->identifier);
+			output->unconfigured = false;
+			output->config = config;
+			// Rendered once the layer surface is configured
+			create_layer_surface(output);
+			continue;
+		}
+		bool changed = config != output->config || !output->frame ||
+			output->frame->generation != config->generation;
+		output->config = config;
+		if (changed) {
+			schedule_render(output);
+		}
+	}
+
+	// Drop images that no configuration refers to anymore
+	struct swaybg_image *image, *tmp_image;
+	wl_list_for_each_safe(image, tmp_image, &state->images, link) {
+		if (image->loading) {
+			continue;
+		}
+		bool used = false;
+		struct swaybg_output_config *config;
+		wl_list_for_each(config, &state->configs, link) {
+			if (config_uses_image(config, image)) {
+				used = true;
+				break;
+			}
+		}
+		if (!used) {
+			destroy_swaybg_image(image);
+		}
+	}
+}
+
+static void display_in(int fd, short mask, void *data) {
+	struct swaybg_state *state = data;
+	state->display_read_prepared = false;
+	if (mask & POLLIN) {
+		if (wl_display_read_events(state->display) == -1) {
+			swaybg_log_errno(LOG_ERROR, "Failed to read Wayland events");
+			state->run_display = false;
+		}
+	} else {
+		wl_display_cancel_read(state->display);
+	}
+	if (mask & (POLLERR | POLLHUP | POLLNVAL)) {
+		state->run_display = false;
+	}
+	// POLLOUT needs nothing here, run_loop flushes on every iteration
+}
+
+static void workers_in(int fd, short mask, void *data) {
+	struct swaybg_state *state = data;
+	worker_pool_dispatch(state->workers);
+}
+
+/*
+ * Sends queued requests without blocking. If the socket buffer is full, the
+ * rest is sent once the compositor has caught up and the socket becomes
+ * writable again.
+ */
+static bool flush_display(struct swaybg_state *state) {
+	short mask = POLLIN;
+	if (wl_display_flush(state->display) == -1) {
+		if (errno != EAGAIN) {
+			swaybg_log_errno(LOG_ERROR, "Failed to flush Wayland requests");
+			return false;
+		}
+		mask |= POLLOUT;
+	}
+	loop_set_fd_mask(state->loop, wl_display_get_fd(state->display), mask);
+	return true;
+}
+
+static void run_loop(struct swaybg_state *state) {
+	while (state->run_display) {
+		if (wl_display_prepare_read(state->display) != 0) {
+			if (wl_display_dispatch_pending(state->display) == -1) {
+				break;
+			}
+			continue;
+		}
+		// Nothing is queued anymore, so the outputs have settled
+		render_dirty_outputs(state);
+		if (!flush_display(state)) {
+			wl_display_cancel_read(state->display);
+			break;
+		}
+
+		state->display_read_prepared = true;
+		loop_poll(state->loop);
+		if (state->display_read_prepared) {
+			// Woken up by another event source
+			wl_display_cancel_read(state->display);
+			state->display_read_prepared = false;
+		}
+
+		if (wl_display_dispatch_pending(state->display) == -1) {
+			break;
+		}
+	}
+}
+
 int main(int argc, char **argv) {
 	swaybg_log_init(LOG_DEBUG);
 
 	struct swaybg_state state = {0};
+	wl_list_init(&state.images);
 	wl_list_init(&state.configs);
 	wl_list_init(&state.outputs);
+	wl_list_init(&state.frames);
+	wl_list_init(&state.compose_jobs);
+	state.watch_fd = -1;
 
 	parse_command_line(argc, argv, &state);
+	if (!state.no_cache) {
+		image_cache_init();
+	}
+	perf_init();
+
+	state.loop = loop_create();
+	state.workers = worker_pool_create();
+	if (!state.loop || !state.workers) {
+		swaybg_log(LOG_ERROR, "Failed to set up the event loop");
+		return 1;
+	}
 
 	state.display = wl_display_connect(NULL);
 	if (!state.display) {
@@ -530,20 +2320,70 @@ int main(int argc, char **argv) {
 			&xdg_output_listener, output);
 	}
 
-	state.run_display = true;
-	while (wl_display_dispatch(state.display) != -1 && state.run_display) {
-		// This space intentionally left blank
+	if (!loop_add_fd(state.loop, wl_display_get_fd(state.display), POLLIN,
+			display_in, &state) ||
+			!loop_add_fd(state.loop, worker_pool_get_fd(state.workers),
+			POLLIN, workers_in, &state)) {
+		return 1;
+	}
+
+	if (state.control_path) {
+		struct control_handler handler = {
+			.command = handle_control_command,
+			.batch_done = handle_control_batch_done,
+			.data = &state,
+		};
+		state.control = control_server_create(state.loop, state.control_path,
+				&handler);
+		if (!state.control) {
+			return 1;
+		}
 	}
 
+	if (state.watch_images) {
+		state.watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (state.watch_fd == -1 || !loop_add_fd(state.loop, state.watch_fd,
+				POLLIN, watch_in, &state)) {
+			swaybg_log_errno(LOG_ERROR, "Failed to set up image watching");
+			return 1;
+		}
+		struct swaybg_image *image;
+		wl_list_for_each(image, &state.images, link) {
+			watch_image(image);
+		}
+	}
+
+	state.run_display = true;
+	run_loop(&state);
+	state.run_display = false;
+	control_server_destroy(state.control);
+	worker_pool_destroy(state.workers);
+
 	struct swaybg_output *tmp_output;
 	wl_list_for_each_safe(output, tmp_output, &state.outputs, link) {
 		destroy_swaybg_output(output);
 	}
+	struct pool_buffer_stats buffer_stats;
+	get_pool_buffer_stats(&buffer_stats);
+	swaybg_log(LOG_DEBUG, "Allocated %llu buffer(s), at most %zu KiB of "
+			"shared memory at once", (unsigned long long)buffer_stats.created,
+			buffer_stats.peak_bytes / 1024);
 
 	struct swaybg_output_config *config = NULL, *tmp_config = NULL;
 	wl_list_for_each_safe(config, tmp_config, &state.configs, link) {
 		destroy_swaybg_output_config(config);
 	}
 
+	struct swaybg_image *image, *tmp_image;
+	wl_list_for_each_safe(image, tmp_image, &state.images, link) {
+		destroy_swaybg_image(image);
+	}
+	if (state.watch_fd != -1) {
+		close(state.watch_fd);
+	}
+	loop_destroy(state.loop);
+	image_cache_finish();
+	perf_finish();
+
 	return 0;
 }
@@ -0,0 +1,66 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "log.h"
+#include "perf.h"
+
+static FILE *perf_file = NULL;
+
+void perf_init(void) {
+	const char *path = getenv("SWAYBG_PERF_LOG");
+	if (!path || !*path) {
+		return;
+	}
+	perf_file = fopen(path, "a");
+	if (!perf_file) {
+		swaybg_log_errno(LOG_ERROR, "Failed to open %s", path);
+		return;
+	}
+	// Records from different threads must not interleave
+	setvbuf(perf_file, NULL, _IOLBF, 0);
+	swaybg_log(LOG_DEBUG, "Recording timings to %s", path);
+}
+
+void perf_finish(void) {
+	if (perf_file) {
+		fclose(perf_file);
+		perf_file = NULL;
+	}
+}
+
+static int64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int64_t perf_start(void) {
+	return perf_file ? now_ns() : 0;
+}
+
+void perf_record(const char *op, int64_t start, int64_t pixels,
+		const char *fmt, ...) {
+	if (!perf_file || !start) {
+		return;
+	}
+	int64_t ns = now_ns() - start;
+	struct rusage usage;
+	long maxrss = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : -1;
+
+	char extra[256] = "";
+	if (fmt) {
+		extra[0] = ',';
+		va_list args;
+		va_start(args, fmt);
+		vsnprintf(extra + 1, sizeof(extra) - 1, fmt, args);
+		va_end(args);
+	}
+	// A single call, so that the line is written in one piece
+	fprintf(perf_file, "{\"op\":\"%s\",\"ns\":%lld,\"pixels\":%lld,"
+			"\"ns_per_pixel\":%.3f,\"maxrss_kb\":%ld%s}\n",
+			op, (long long)ns, (long long)pixels,
+			pixels > 0 ? (double)ns / pixels : 0.0, maxrss, extra);
+}
@@ -0,0 +1,278 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "pixel-convert.h"
+#include "pixel-convert-variants.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_SIMD
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && !defined(__ARM_BIG_ENDIAN)
+#define ARM_NEON
+#include <arm_neon.h>
+#endif
+
+void convert_rgb_row_scalar(const uint8_t *src, uint8_t *dst, int width) {
+	const uint8_t *end = src + 3 * width;
+	while (src < end) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+		dst[3] = 0;
+#else
+		dst[0] = 0;
+		dst[1] = src[0];
+		dst[2] = src[1];
+		dst[3] = src[2];
+#endif
+		src += 3;
+		dst += 4;
+	}
+}
+
+/* premul-color = alpha/255 * color/255 * 255 = (alpha*color)/255
+ * (z/255) = z/256 * 256/255     = z/256 (1 + 1/255)
+ *         = z/256 + (z/256)/255 = (z + z/255)/256
+ *         # recurse once
+ *         = (z + (z + z/255)/256)/256
+ *         = (z + z/256 + z/256/255) / 256
+ *         # only use 16bit uint operations, loose some precision,
+ *         # result is floored.
+ *       ->  (z + z>>8)>>8
+ *         # add 0x80/255 = 0.5 to convert floor to round
+ *       =>  (z+0x80 + (z+0x80)>>8 ) >> 8
+ * ------
+ * tested as equal to lround(z/255.0) for uint z in [0..0xfe02]
+ *
+ * Every intermediate value fits in 16 bits, which is what lets the SIMD
+ * variants below compute the same result in 16-bit lanes.
+ */
+static inline uint8_t premul_alpha(uint8_t color, uint8_t alpha) {
+	unsigned z = color * alpha + 0x80;
+	return (z + (z >> 8)) >> 8;
+}
+
+void convert_rgba_row_scalar(const uint8_t *src, uint8_t *dst, int width) {
+	const uint8_t *end = src + 4 * width;
+	while (src < end) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		dst[0] = premul_alpha(src[2], src[3]);
+		dst[1] = premul_alpha(src[1], src[3]);
+		dst[2] = premul_alpha(src[0], src[3]);
+		dst[3] = src[3];
+#else
+		dst[0] = src[3];
+		dst[1] = premul_alpha(src[0], src[3]);
+		dst[2] = premul_alpha(src[1], src[3]);
+		dst[3] = premul_alpha(src[2], src[3]);
+#endif
+		src += 4;
+		dst += 4;
+	}
+}
+
+#ifdef X86_SIMD
+
+/*
+ * Premultiplies two RGBA pixels unpacked to 16-bit lanes and swaps them to
+ * BGRA. The alpha lanes are multiplied by 255, which leaves them unchanged.
+ */
+__attribute__((target("sse2")))
+static inline __m128i premul_sse2(__m128i c) {
+	const __m128i alpha_lanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	__m128i a = _mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 3, 3));
+	a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+	a = _mm_or_si128(_mm_andnot_si128(alpha_lanes, a),
+			_mm_and_si128(alpha_lanes, _mm_set1_epi16(0xFF)));
+	__m128i z = _mm_add_epi16(_mm_mullo_epi16(c, a), _mm_set1_epi16(0x80));
+	z = _mm_srli_epi16(_mm_add_epi16(z, _mm_srli_epi16(z, 8)), 8);
+	z = _mm_shufflelo_epi16(z, _MM_SHUFFLE(3, 0, 1, 2));
+	return _mm_shufflehi_epi16(z, _MM_SHUFFLE(3, 0, 1, 2));
+}
+
+__attribute__((target("sse2")))
+static void convert_rgba_row_sse2(const uint8_t *src, uint8_t *dst,
+		int width) {
+	const __m128i zero = _mm_setzero_si128();
+	int x = 0;
+	for (; x + 4 <= width; x += 4) {
+		__m128i px = _mm_loadu_si128((const __m128i *)(src + 4 * x));
+		__m128i lo = premul_sse2(_mm_unpacklo_epi8(px, zero));
+		__m128i hi = premul_sse2(_mm_unpackhi_epi8(px, zero));
+		_mm_storeu_si128((__m128i *)(dst + 4 * x), _mm_packus_epi16(lo, hi));
+	}
+	convert_rgba_row_scalar(src + 4 * x, dst + 4 * x, width - x);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i premul_avx2(__m256i c) {
+	const __m256i alpha_lanes = _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0,
+			-1, 0, 0, 0, -1, 0, 0, 0);
+	__m256i a = _mm256_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 3, 3));
+	a = _mm256_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+	a = _mm256_or_si256(_mm256_andnot_si256(alpha_lanes, a),
+			_mm256_and_si256(alpha_lanes, _mm256_set1_epi16(0xFF)));
+	__m256i z = _mm256_add_epi16(_mm256_mullo_epi16(c, a),
+			_mm256_set1_epi16(0x80));
+	z = _mm256_srli_epi16(_mm256_add_epi16(z, _mm256_srli_epi16(z, 8)), 8);
+	z = _mm256_shufflelo_epi16(z, _MM_SHUFFLE(3, 0, 1, 2));
+	return _mm256_shufflehi_epi16(z, _MM_SHUFFLE(3, 0, 1, 2));
+}
+
+__attribute__((target("avx2")))
+static void convert_rgba_row_avx2(const uint8_t *src, uint8_t *dst,
+		int width) {
+	const __m256i zero = _mm256_setzero_si256();
+	int x = 0;
+	for (; x + 8 <= width; x += 8) {
+		__m256i px = _mm256_loadu_si256((const __m256i *)(src + 4 * x));
+		// Unpacking and packing both work within 128-bit lanes, so the
+		// pixels come back out in their original order
+		__m256i lo = premul_avx2(_mm256_unpacklo_epi8(px, zero));
+		__m256i hi = premul_avx2(_mm256_unpackhi_epi8(px, zero));
+		_mm256_storeu_si256((__m256i *)(dst + 4 * x),
+				_mm256_packus_epi16(lo, hi));
+	}
+	convert_rgba_row_scalar(src + 4 * x, dst + 4 * x, width - x);
+}
+
+/*
+ * SSE2 has no byte shuffle, which is what the 3 to 4 byte expansion needs,
+ * so the RGB path starts at SSSE3.
+ */
+__attribute__((target("ssse3")))
+static void convert_rgb_row_ssse3(const uint8_t *src, uint8_t *dst,
+		int width) {
+	const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -128, 5, 4, 3, -128,
+			8, 7, 6, -128, 11, 10, 9, -128);
+	int x = 0;
+	// Each load reads 16 bytes to convert 12, stay clear of the row end
+	for (; x + 6 <= width; x += 4) {
+		__m128i px = _mm_loadu_si128((const __m128i *)(src + 3 * x));
+		_mm_storeu_si128((__m128i *)(dst + 4 * x),
+				_mm_shuffle_epi8(px, shuffle));
+	}
+	convert_rgb_row_scalar(src + 3 * x, dst + 4 * x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void convert_rgb_row_avx2(const uint8_t *src, uint8_t *dst,
+		int width) {
+	const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, -128, 5, 4, 3, -128,
+			8, 7, 6, -128, 11, 10, 9, -128,
+			2, 1, 0, -128, 5, 4, 3, -128,
+			8, 7, 6, -128, 11, 10, 9, -128);
+	int x = 0;
+	for (; x + 10 <= width; x += 8) {
+		__m128i lo = _mm_loadu_si128((const __m128i *)(src + 3 * x));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(src + 3 * x + 12));
+		__m256i px = _mm256_inserti128_si256(_mm256_castsi128_si256(lo),
+				hi, 1);
+		_mm256_storeu_si256((__m256i *)(dst + 4 * x),
+				_mm256_shuffle_epi8(px, shuffle));
+	}
+	convert_rgb_row_scalar(src + 3 * x, dst + 4 * x, width - x);
+}
+
+#endif // X86_SIMD
+
+#ifdef ARM_NEON
+
+static void convert_rgb_row_neon(const uint8_t *src, uint8_t *dst,
+		int width) {
+	int x = 0;
+	for (; x + 16 <= width; x += 16) {
+		uint8x16x3_t px = vld3q_u8(src + 3 * x);
+		uint8x16x4_t out = {{ px.val[2], px.val[1], px.val[0],
+			vdupq_n_u8(0) }};
+		vst4q_u8(dst + 4 * x, out);
+	}
+	convert_rgb_row_scalar(src + 3 * x, dst + 4 * x, width - x);
+}
+
+static inline uint8x16_t premul_neon(uint8x16_t c, uint8x16_t a) {
+	const uint16x8_t round = vdupq_n_u16(0x80);
+	uint16x8_t lo = vmlal_u8(round, vget_low_u8(c), vget_low_u8(a));
+	uint16x8_t hi = vmlal_u8(round, vget_high_u8(c), vget_high_u8(a));
+	lo = vaddq_u16(lo, vshrq_n_u16(lo, 8));
+	hi = vaddq_u16(hi, vshrq_n_u16(hi, 8));
+	return vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+}
+
+static void convert_rgba_row_neon(const uint8_t *src, uint8_t *dst,
+		int width) {
+	int x = 0;
+	for (; x + 16 <= width; x += 16) {
+		uint8x16x4_t px = vld4q_u8(src + 4 * x);
+		uint8x16x4_t out = {{
+			premul_neon(px.val[2], px.val[3]),
+			premul_neon(px.val[1], px.val[3]),
+			premul_neon(px.val[0], px.val[3]),
+			px.val[3],
+		}};
+		vst4q_u8(dst + 4 * x, out);
+	}
+	convert_rgba_row_scalar(src + 4 * x, dst + 4 * x, width - x);
+}
+
+#endif // ARM_NEON
+
+#ifdef X86_SIMD
+
+// __builtin_cpu_supports only takes string literals
+static bool has_sse2(void) {
+	return __builtin_cpu_supports("sse2");
+}
+
+static bool has_ssse3(void) {
+	return __builtin_cpu_supports("ssse3");
+}
+
+static bool has_avx2(void) {
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif // X86_SIMD
+
+const struct row_converter rgb_row_converters[] = {
+#if defined(X86_SIMD)
+	{ "avx2", convert_rgb_row_avx2, has_avx2 },
+	{ "ssse3", convert_rgb_row_ssse3, has_ssse3 },
+#elif defined(ARM_NEON)
+	{ "neon", convert_rgb_row_neon, NULL },
+#endif
+	{ "scalar", convert_rgb_row_scalar, NULL },
+	{ NULL, NULL, NULL },
+};
+
+const struct row_converter rgba_row_converters[] = {
+#if defined(X86_SIMD)
+	{ "avx2", convert_rgba_row_avx2, has_avx2 },
+	{ "sse2", convert_rgba_row_sse2, has_sse2 },
+#elif defined(ARM_NEON)
+	{ "neon", convert_rgba_row_neon, NULL },
+#endif
+	{ "scalar", convert_rgba_row_scalar, NULL },
+	{ NULL, NULL, NULL },
+};
+
+bool row_converter_supported(const struct row_converter *converter) {
+	return !converter->supported || converter->supported();
+}
+
+static convert_row_func get_row_converter(
+		const struct row_converter *converters) {
+	for (; !row_converter_supported(converters); ++converters) {
+		// The scalar one is always supported
+	}
+	return converters->convert;
+}
+
+convert_row_func get_rgb_row_converter(void) {
+	return get_row_converter(rgb_row_converters);
+}
+
+convert_row_func get_rgba_row_converter(void) {
+	return get_row_converter(rgba_row_converters);
+}
@@ -1,5 +1,6 @@
 #define _POSIX_C_SOURCE 200809
-#include <assert.h>
+#define _GNU_SOURCE // memfd_create, F_ADD_SEALS
+#include "config.h"
 #include <cairo.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -8,8 +9,11 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <wayland-client.h>
+#include "perf.h"
 #include "pool-buffer.h"
 
+static struct pool_buffer_stats stats = {0};
+
 static bool set_cloexec(int fd) {
 	long flags = fcntl(fd, F_GETFD);
 	if (flags == -1) {
@@ -23,7 +27,38 @@ static bool set_cloexec(int fd) {
 	return true;
 }
 
+#if HAVE_MEMFD_CREATE
+static int create_memfd(size_t size) {
+	int fd = memfd_create("swaybg-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	// The compositor maps this file too; promising that it never shrinks
+	// means it cannot fault on access past the end
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+#endif
+
 static int create_pool_file(size_t size, char **name) {
+	*name = NULL;
+#if HAVE_MEMFD_CREATE
+	int memfd = create_memfd(size);
+	if (memfd >= 0) {
+		return memfd;
+	}
+#endif
+
 	static const char template[] = "sway-client-XXXXXX";
 	const char *path = getenv("XDG_RUNTIME_DIR");
 	if (path == NULL) {
@@ -60,40 +95,71 @@ static int create_pool_file(size_t size, char **name) {
 static void buffer_release(void *data, struct wl_buffer *wl_buffer) {
 	struct pool_buffer *buffer = data;
 	buffer->busy = false;
+	if (buffer->destroy_on_release) {
+		destroy_buffer(buffer);
+	}
 }
 
 static const struct wl_buffer_listener buffer_listener = {
 	.release = buffer_release
 };
 
-static struct pool_buffer *create_buffer(struct wl_shm *shm,
-		struct pool_buffer *buf, int32_t width, int32_t height,
+int map_buffer(struct pool_buffer *buf, int32_t width, int32_t height,
 		uint32_t format) {
 	uint32_t stride = width * 4;
-	size_t size = stride * height;
+	size_t size = (size_t)stride * height;
 
 	char *name;
 	int fd = create_pool_file(size, &name);
-	assert(fd != -1);
+	if (name) {
+		unlink(name);
+		free(name);
+	}
+	if (fd < 0) {
+		return -1;
+	}
 	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
-	buf->buffer = wl_shm_pool_create_buffer(pool, 0,
-			width, height, stride, format);
-	wl_shm_pool_destroy(pool);
-	close(fd);
-	unlink(name);
-	free(name);
-	fd = -1;
+	if (data == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
 
 	buf->size = size;
 	buf->width = width;
 	buf->height = height;
+	buf->format = format;
 	buf->data = data;
+	cairo_format_t cairo_format = format == WL_SHM_FORMAT_XRGB8888 ?
+		CAIRO_FORMAT_RGB24 : CAIRO_FORMAT_ARGB32;
 	buf->surface = cairo_image_surface_create_for_data(data,
-			CAIRO_FORMAT_ARGB32, width, height, stride);
+			cairo_format, width, height, stride);
 	buf->cairo = cairo_create(buf->surface);
 
+	stats.created++;
+	stats.bytes += size;
+	if (stats.bytes > stats.peak_bytes) {
+		stats.peak_bytes = stats.bytes;
+	}
+	return fd;
+}
+
+static struct pool_buffer *create_buffer(struct wl_shm *shm,
+		struct pool_buffer *buf, int32_t width, int32_t height,
+		uint32_t format) {
+	int64_t start = perf_start();
+	int fd = map_buffer(buf, width, height, format);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, buf->size);
+	buf->buffer = wl_shm_pool_create_buffer(pool, 0,
+			width, height, width * 4, format);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
 	wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
+	perf_record("create_buffer", start, (int64_t)width * height,
+			"\"width\":%d,\"height\":%d", width, height);
 	return buf;
 }
 
@@ -109,35 +175,62 @@ void destroy_buffer(struct pool_buffer *buffer) {
 	}
 	if (buffer->data) {
 		munmap(buffer->data, buffer->size);
+		stats.bytes -= buffer->size;
 	}
 	memset(buffer, 0, sizeof(struct pool_buffer));
 }
 
-struct pool_buffer *get_next_buffer(struct wl_shm *shm,
-		struct pool_buffer pool[static 2], uint32_t width, uint32_t height) {
-	struct pool_buffer *buffer = NULL;
+bool pool_buffer_is_free(const struct pool_buffer *buffer) {
+	return !buffer->busy && buffer->attach_count <= 1;
+}
 
-	for (size_t i = 0; i < 2; ++i) {
-		if (pool[i].busy) {
-			continue;
+static struct pool_buffer *prepare_buffer(struct wl_shm *shm,
+		struct pool_buffer *buffer, uint32_t width, uint32_t height,
+		uint32_t format) {
+	buffer->destroy_on_release = false;
+	if (buffer->width != width || buffer->height != height ||
+			buffer->format != format || !pool_buffer_is_free(buffer)) {
+		destroy_buffer(buffer);
+	}
+
+	if (!buffer->buffer) {
+		if (!create_buffer(shm, buffer, width, height, format)) {
+			return NULL;
 		}
-		buffer = &pool[i];
 	}
+	buffer->busy = true;
+	buffer->attach_count = 0;
+	return buffer;
+}
 
-	if (!buffer) {
+struct pool_buffer *get_single_buffer(struct wl_shm *shm,
+		struct pool_buffer pool[static 2], uint32_t width, uint32_t height,
+		uint32_t format) {
+	struct pool_buffer *buffer = NULL, *other = NULL;
+	if (!pool[0].busy) {
+		buffer = &pool[0];
+		other = &pool[1];
+	} else if (!pool[1].busy) {
+		// Only needed until the compositor lets go of the first one
+		buffer = &pool[1];
+		other = &pool[0];
+	} else {
 		return NULL;
 	}
 
-	if (buffer->width != width || buffer->height != height) {
-		destroy_buffer(buffer);
+	if (!prepare_buffer(shm, buffer, width, height, format)) {
+		return NULL;
 	}
 
-	if (!buffer->buffer) {
-		if (!create_buffer(shm, buffer, width, height,
-					WL_SHM_FORMAT_ARGB8888)) {
-			return NULL;
-		}
+	// The other buffer is superseded once this one is committed
+	if (other->busy) {
+		other->destroy_on_release = true;
+	} else {
+		destroy_buffer(other);
 	}
-	buffer->busy = true;
 	return buffer;
 }
+
+void get_pool_buffer_stats(struct pool_buffer_stats *out) {
+	*out = stats;
+}
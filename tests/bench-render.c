@@ -0,0 +1,302 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <cairo.h>
+#include "background-image.h"
+#include "cairo_util.h"
+#include "compose.h"
+#include "log.h"
+#include "perf.h"
+#include "pixel-convert.h"
+#include "pool-buffer.h"
+#include "worker.h"
+
+/*
+ * Times the steps of drawing a background without a compositor: decoding,
+ * pixel conversion, downscaling and composing, for every pair of image and
+ * buffer size below and every mode. Buffers are timed on their own: mapping
+ * the shared memory, and then filling it, which is when its pages are
+ * faulted in. The results are the records of the perf log, one JSON object
+ * per line, written to stdout unless $SWAYBG_PERF_LOG names another file.
+ *
+ * Usage: bench-render [iterations]
+ */
+
+#define BACKGROUND_COLOR 0x336699FF
+
+struct size {
+	int width, height;
+};
+
+// A small image that is scaled up, a 4K screenshot and a camera photo
+static const struct size image_sizes[] = {
+	{ 1280, 720 },
+	{ 3840, 2160 },
+	{ 6000, 4000 },
+};
+
+// 1x1 is the single pixel buffer that the viewport stretches over outputs
+// with a solid color background
+static const struct size buffer_sizes[] = {
+	{ 1, 1 },
+	{ 1920, 1080 },
+	{ 2560, 1440 },
+	{ 3840, 2160 },
+};
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+static uint32_t rng_state = 0x9e3779b9;
+
+static uint32_t next_random(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+/*
+ * Gradients with some noise, so that the PNG neither compresses to nothing
+ * nor is incompressible, like a photo.
+ */
+static cairo_surface_t *create_image(int width, int height) {
+	cairo_surface_t *image = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+			width, height);
+	if (cairo_surface_status(image) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(image);
+		return NULL;
+	}
+	cairo_surface_flush(image);
+	uint8_t *data = cairo_image_surface_get_data(image);
+	int stride = cairo_image_surface_get_stride(image);
+	for (int y = 0; y < height; ++y) {
+		uint32_t *row = (uint32_t *)(data + (size_t)y * stride);
+		for (int x = 0; x < width; ++x) {
+			uint32_t noise = next_random() & 0x0f0f0f;
+			row[x] = (uint32_t)(x * 255 / width) << 16 |
+				(uint32_t)(y * 255 / height) << 8 |
+				(uint32_t)((x + y) & 0xff);
+			row[x] ^= noise;
+		}
+	}
+	cairo_surface_mark_dirty(image);
+	return image;
+}
+
+static void decode(const char *path, const struct background_target *target,
+		int count) {
+	struct background_image_info info;
+	int64_t start = perf_start();
+	cairo_surface_t *image = load_background_image(path, target, count, &info);
+	if (!image) {
+		return;
+	}
+	int width = cairo_image_surface_get_width(image);
+	int height = cairo_image_surface_get_height(image);
+	perf_record("decode", start, (int64_t)width * height,
+			"\"image_width\":%d,\"image_height\":%d,"
+			"\"width\":%d,\"height\":%d",
+			info.width, info.height, width, height);
+	cairo_surface_destroy(image);
+}
+
+static void bench_decode(const char *path, int iterations) {
+	for (int i = 0; i < iterations; ++i) {
+		// At full size, and at the size each output needs
+		decode(path, NULL, 0);
+		for (size_t b = 0; b < COUNT(buffer_sizes); ++b) {
+			struct background_target target = {
+				.mode = BACKGROUND_MODE_FILL,
+				.width = buffer_sizes[b].width,
+				.height = buffer_sizes[b].height,
+			};
+			decode(path, &target, 1);
+		}
+	}
+}
+
+static void bench_convert(int width, int height, int iterations) {
+	size_t src_stride = 4 * (size_t)width;
+	size_t dst_stride = 4 * (size_t)width;
+	uint8_t *src = malloc(src_stride * height);
+	uint8_t *dst = malloc(dst_stride * height);
+	if (!src || !dst) {
+		swaybg_log(LOG_ERROR, "Failed to allocate pixels");
+		free(src);
+		free(dst);
+		return;
+	}
+	for (size_t i = 0; i < src_stride * height; ++i) {
+		src[i] = next_random();
+	}
+
+	struct {
+		const char *format;
+		convert_row_func convert;
+		int bpp;
+	} formats[] = {
+		{ "rgb", get_rgb_row_converter(), 3 },
+		{ "rgba", get_rgba_row_converter(), 4 },
+	};
+	for (int i = 0; i < iterations; ++i) {
+		for (size_t f = 0; f < COUNT(formats); ++f) {
+			int64_t start = perf_start();
+			for (int y = 0; y < height; ++y) {
+				formats[f].convert(
+						src + (size_t)y * formats[f].bpp * width,
+						dst + (size_t)y * dst_stride, width);
+			}
+			perf_record("convert", start, (int64_t)width * height,
+					"\"format\":\"%s\",\"width\":%d,\"height\":%d",
+					formats[f].format, width, height);
+		}
+	}
+	free(src);
+	free(dst);
+}
+
+/*
+ * Maps a buffer as create_buffer does, minus the wl_buffer, and fills it with
+ * frame, or with color if frame is NULL, as render_shared_frame does.
+ * Reports both halves apart: mapping only reserves the memory, and the first
+ * write pays for faulting its pages in.
+ */
+static void bench_buffer(cairo_surface_t *frame, uint32_t color,
+		int width, int height, const char *mode) {
+	struct pool_buffer buffer = {0};
+	uint32_t format = !frame ||
+		cairo_image_surface_get_format(frame) == CAIRO_FORMAT_RGB24 ?
+		WL_SHM_FORMAT_XRGB8888 : WL_SHM_FORMAT_ARGB8888;
+	int64_t start = perf_start();
+	int fd = map_buffer(&buffer, width, height, format);
+	if (fd < 0) {
+		swaybg_log_errno(LOG_ERROR, "Failed to map a %dx%d buffer",
+				width, height);
+		return;
+	}
+	close(fd);
+	perf_record("map_buffer", start, (int64_t)width * height,
+			"\"width\":%d,\"height\":%d", width, height);
+
+	start = perf_start();
+	if (frame) {
+		cairo_image_surface_copy(buffer.surface, frame);
+	} else {
+		cairo_set_source_u32(buffer.cairo, color);
+		cairo_paint(buffer.cairo);
+		cairo_surface_flush(buffer.surface);
+	}
+	perf_record("fill_buffer", start, (int64_t)width * height,
+			"\"mode\":\"%s\",\"width\":%d,\"height\":%d",
+			mode, width, height);
+	destroy_buffer(&buffer);
+}
+
+static void bench_solid_color(int iterations) {
+	for (int i = 0; i < iterations; ++i) {
+		for (size_t b = 0; b < COUNT(buffer_sizes); ++b) {
+			bench_buffer(NULL, BACKGROUND_COLOR, buffer_sizes[b].width,
+					buffer_sizes[b].height,
+					background_mode_name(BACKGROUND_MODE_SOLID_COLOR));
+		}
+	}
+}
+
+// downscale_image and compose_background record themselves
+static void bench_scale(struct worker_pool *workers, cairo_surface_t *image,
+		int width, int height, int iterations) {
+	if (cairo_image_surface_get_width(image) <= width ||
+			cairo_image_surface_get_height(image) <= height) {
+		return;
+	}
+	for (int i = 0; i < iterations; ++i) {
+		cairo_surface_destroy(downscale_image(workers, image, width, height));
+	}
+}
+
+static void bench_compose(struct worker_pool *workers, cairo_surface_t *image,
+		int width, int height, int iterations) {
+	for (int i = 0; i < iterations; ++i) {
+		for (enum background_mode mode = BACKGROUND_MODE_STRETCH;
+				mode < BACKGROUND_MODE_SOLID_COLOR; ++mode) {
+			cairo_surface_t *frame = compose_background(workers, image,
+					mode, BACKGROUND_COLOR, width, height);
+			if (frame) {
+				bench_buffer(frame, 0, width, height,
+						background_mode_name(mode));
+			}
+			cairo_surface_destroy(frame);
+		}
+	}
+}
+
+static bool bench_image(struct worker_pool *workers, const char *path,
+		struct size size, int iterations) {
+	cairo_surface_t *image = create_image(size.width, size.height);
+	if (!image) {
+		swaybg_log(LOG_ERROR, "Failed to create a %dx%d image",
+				size.width, size.height);
+		return false;
+	}
+	if (cairo_surface_write_to_png(image, path) != CAIRO_STATUS_SUCCESS) {
+		swaybg_log(LOG_ERROR, "Failed to write %s", path);
+		cairo_surface_destroy(image);
+		return false;
+	}
+
+	bench_decode(path, iterations);
+	bench_convert(size.width, size.height, iterations);
+	// The 1x1 buffer is only ever used for solid colors
+	for (size_t b = 1; b < COUNT(buffer_sizes); ++b) {
+		bench_scale(workers, image, buffer_sizes[b].width,
+				buffer_sizes[b].height, iterations);
+		bench_compose(workers, image, buffer_sizes[b].width,
+				buffer_sizes[b].height, iterations);
+	}
+	cairo_surface_destroy(image);
+	unlink(path);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 3;
+	if (iterations <= 0) {
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	swaybg_log_init(LOG_ERROR);
+	setenv("SWAYBG_PERF_LOG", "/dev/stdout", 0);
+	perf_init();
+
+	char dir[] = "/tmp/swaybg-bench.XXXXXX";
+	if (!mkdtemp(dir)) {
+		swaybg_log_errno(LOG_ERROR, "Failed to create %s", dir);
+		return EXIT_FAILURE;
+	}
+	char path[sizeof(dir) + 16];
+	snprintf(path, sizeof(path), "%s/image.png", dir);
+
+	int ret = EXIT_FAILURE;
+	struct worker_pool *workers = worker_pool_create();
+	if (!workers) {
+		goto out;
+	}
+
+	bench_solid_color(iterations);
+	for (size_t i = 0; i < COUNT(image_sizes); ++i) {
+		if (!bench_image(workers, path, image_sizes[i], iterations)) {
+			goto out;
+		}
+	}
+	ret = EXIT_SUCCESS;
+
+out:
+	worker_pool_destroy(workers);
+	unlink(path);
+	rmdir(dir);
+	perf_finish();
+	return ret;
+}
@@ -0,0 +1,171 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image-scale-variants.h"
+
+// Rows of 4-byte pixels, so that lengths in bytes cover every remainder
+#define MAX_LEN (4 * 1921 + 3)
+#define MAX_OFFSET 3
+#define SENTINEL 0xa5
+
+static uint32_t rng_state = 0x9e3779b9;
+
+static uint32_t next_random(void) {
+	// xorshift32, so that failures can be reproduced
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+// The scalar kernel is the last one in each table
+static const struct accumulate_row_kernel *scalar_accumulate(void) {
+	const struct accumulate_row_kernel *kernel = accumulate_row_kernels;
+	while (kernel[1].name) {
+		++kernel;
+	}
+	return kernel;
+}
+
+static const struct store_row_kernel *scalar_store(void) {
+	const struct store_row_kernel *kernel = store_row_kernels;
+	while (kernel[1].name) {
+		++kernel;
+	}
+	return kernel;
+}
+
+/*
+ * Adds a row to sums that are partway through, as when several source rows
+ * contribute to one output row, and compares the sums and the accumulators
+ * right after them, which must be left alone.
+ */
+static bool check_accumulate_len(const struct accumulate_row_kernel *kernel,
+		accumulate_row_func reference, const uint8_t *row, int len,
+		int offset, uint16_t weight) {
+	static uint32_t start[MAX_LEN + MAX_OFFSET + 4];
+	static uint32_t expected[MAX_LEN + MAX_OFFSET + 4];
+	static uint32_t actual[MAX_LEN + MAX_OFFSET + 4];
+	size_t count = sizeof(start) / sizeof(start[0]);
+	for (size_t i = 0; i < count; ++i) {
+		start[i] = next_random() % (254 * WEIGHT_ONE);
+	}
+	memcpy(expected, start, sizeof(start));
+	memcpy(actual, start, sizeof(start));
+	reference(expected + offset, row + offset, weight, len);
+	kernel->func(actual + offset, row + offset, weight, len);
+	for (size_t i = 0; i < count; ++i) {
+		if (expected[i] != actual[i]) {
+			fprintf(stderr, "accumulate %s: len %d, offset %d, weight %u: "
+					"sum %zu is %u, expected %u\n", kernel->name, len,
+					offset, weight, i, actual[i], expected[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool check_store_len(const struct store_row_kernel *kernel,
+		store_row_func reference, const uint32_t *acc, int len, int offset) {
+	static uint8_t expected[MAX_LEN + MAX_OFFSET + 16];
+	static uint8_t actual[MAX_LEN + MAX_OFFSET + 16];
+	memset(expected, SENTINEL, sizeof(expected));
+	memset(actual, SENTINEL, sizeof(actual));
+	reference(acc + offset, expected + offset, len);
+	kernel->func(acc + offset, actual + offset, len);
+	for (size_t i = 0; i < sizeof(actual); ++i) {
+		if (expected[i] != actual[i]) {
+			fprintf(stderr, "store %s: len %d, offset %d: byte %zu is %u, "
+					"expected %u\n", kernel->name, len, offset, i,
+					actual[i], expected[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool check_accumulate(const struct accumulate_row_kernel *kernel,
+		accumulate_row_func reference) {
+	static uint8_t row[MAX_LEN + MAX_OFFSET];
+	for (size_t i = 0; i < sizeof(row); ++i) {
+		row[i] = next_random();
+	}
+	const uint16_t weights[] = { 0, 1, WEIGHT_ROUND, WEIGHT_ONE - 1,
+		WEIGHT_ONE };
+	for (int offset = 0; offset <= MAX_OFFSET; ++offset) {
+		for (size_t w = 0; w < sizeof(weights) / sizeof(weights[0]); ++w) {
+			// Every remainder the vector loops can leave, and a long row
+			for (int len = 0; len <= 67; ++len) {
+				if (!check_accumulate_len(kernel, reference, row, len,
+						offset, weights[w])) {
+					return false;
+				}
+			}
+			if (!check_accumulate_len(kernel, reference, row, MAX_LEN,
+					offset, weights[w])) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool check_store(const struct store_row_kernel *kernel,
+		store_row_func reference) {
+	static uint32_t acc[MAX_LEN + MAX_OFFSET];
+	size_t count = sizeof(acc) / sizeof(acc[0]);
+	for (size_t i = 0; i < count; ++i) {
+		acc[i] = next_random() % (255 * WEIGHT_ONE + 1);
+	}
+	// Right at the rounding steps and at the ends of the range
+	const uint32_t edges[] = { 0, WEIGHT_ROUND - 1, WEIGHT_ROUND,
+		WEIGHT_ONE + WEIGHT_ROUND - 1, WEIGHT_ONE + WEIGHT_ROUND,
+		254 * WEIGHT_ONE + WEIGHT_ROUND, 255 * WEIGHT_ONE };
+	for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); ++i) {
+		acc[i] = edges[i];
+	}
+	for (int offset = 0; offset <= MAX_OFFSET; ++offset) {
+		for (int len = 0; len <= 67; ++len) {
+			if (!check_store_len(kernel, reference, acc, len, offset)) {
+				return false;
+			}
+		}
+		if (!check_store_len(kernel, reference, acc, MAX_LEN, offset)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(void) {
+	bool ok = true;
+	accumulate_row_func accumulate = scalar_accumulate()->func;
+	for (const struct accumulate_row_kernel *kernel = accumulate_row_kernels;
+			kernel->name; ++kernel) {
+		if (kernel->func == accumulate) {
+			continue;
+		}
+		if (!scale_kernel_supported(kernel->supported)) {
+			fprintf(stderr, "accumulate %s: not supported by this CPU, "
+					"skipped\n", kernel->name);
+			continue;
+		}
+		ok = check_accumulate(kernel, accumulate) && ok;
+	}
+	store_row_func store = scalar_store()->func;
+	for (const struct store_row_kernel *kernel = store_row_kernels;
+			kernel->name; ++kernel) {
+		if (kernel->func == store) {
+			continue;
+		}
+		if (!scale_kernel_supported(kernel->supported)) {
+			fprintf(stderr, "store %s: not supported by this CPU, "
+					"skipped\n", kernel->name);
+			continue;
+		}
+		ok = check_store(kernel, store) && ok;
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
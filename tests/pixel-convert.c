@@ -0,0 +1,131 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pixel-convert.h"
+#include "pixel-convert-variants.h"
+
+#define MAX_WIDTH 1921
+#define MAX_OFFSET 3
+
+static uint32_t rng_state = 0x9e3779b9;
+
+static uint8_t next_byte(void) {
+	// xorshift32, so that failures can be reproduced
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state >> 24;
+}
+
+/*
+ * Converts width pixels starting offset bytes into src with both converters
+ * and reports the first pixel that differs.
+ */
+static bool check_row(const char *name, convert_row_func convert,
+		convert_row_func reference, const uint8_t *src, int bpp,
+		int width, int offset) {
+	static uint8_t expected[4 * MAX_WIDTH], actual[4 * MAX_WIDTH + MAX_OFFSET];
+	// Sentinels after the row catch converters writing past its end
+	memset(actual, 0xa5, sizeof(actual));
+	reference(src + offset, expected, width);
+	convert(src + offset, actual + offset, width);
+	for (int x = 0; x < width; ++x) {
+		if (memcmp(&expected[4 * x], &actual[offset + 4 * x], 4) != 0) {
+			const uint8_t *px = src + offset + bpp * x;
+			fprintf(stderr, "%s: width %d, offset %d: pixel %d "
+					"(%02x %02x %02x %02x) converted to %02x%02x%02x%02x, "
+					"expected %02x%02x%02x%02x\n", name, width, offset, x,
+					px[0], px[1], px[2], bpp == 4 ? px[3] : 0xff,
+					actual[offset + 4 * x], actual[offset + 4 * x + 1],
+					actual[offset + 4 * x + 2], actual[offset + 4 * x + 3],
+					expected[4 * x], expected[4 * x + 1],
+					expected[4 * x + 2], expected[4 * x + 3]);
+			return false;
+		}
+	}
+	for (int i = offset + 4 * width; i < (int)sizeof(actual); ++i) {
+		if (actual[i] != 0xa5) {
+			fprintf(stderr, "%s: width %d, offset %d: wrote past the row\n",
+					name, width, offset);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool check_converter(const char *name, convert_row_func convert,
+		convert_row_func reference, const uint8_t *src, int bpp) {
+	for (int offset = 0; offset <= MAX_OFFSET; ++offset) {
+		// Every remainder the vector loops can leave, and a long row
+		for (int width = 0; width <= 67; ++width) {
+			if (!check_row(name, convert, reference, src, bpp,
+					width, offset)) {
+				return false;
+			}
+		}
+		if (!check_row(name, convert, reference, src, bpp,
+				MAX_WIDTH, offset)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Every color and alpha pair goes through the premultiplication
+static bool check_premultiplication(const char *name,
+		convert_row_func convert) {
+	static uint8_t pairs[4 * 256 * 256];
+	for (int i = 0; i < 256 * 256; ++i) {
+		pairs[4 * i] = pairs[4 * i + 1] = pairs[4 * i + 2] = i & 0xff;
+		pairs[4 * i + 3] = i >> 8;
+	}
+	static uint8_t expected[sizeof(pairs)], actual[sizeof(pairs)];
+	convert_rgba_row_scalar(pairs, expected, 256 * 256);
+	convert(pairs, actual, 256 * 256);
+	if (memcmp(expected, actual, sizeof(pairs)) != 0) {
+		fprintf(stderr, "%s: premultiplied colors differ\n", name);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Checks every variant the CPU supports against the scalar one, which is
+ * the last in the table.
+ */
+static bool check_variants(const char *format,
+		const struct row_converter *converters, const uint8_t *src, int bpp) {
+	convert_row_func reference = bpp == 4 ?
+		convert_rgba_row_scalar : convert_rgb_row_scalar;
+	bool ok = true;
+	for (; converters->name; ++converters) {
+		if (converters->convert == reference) {
+			continue;
+		}
+		if (!row_converter_supported(converters)) {
+			fprintf(stderr, "%s %s: not supported by this CPU, skipped\n",
+					format, converters->name);
+			continue;
+		}
+		char name[64];
+		snprintf(name, sizeof(name), "%s %s", format, converters->name);
+		ok = check_converter(name, converters->convert, reference,
+				src, bpp) && ok;
+		if (bpp == 4) {
+			ok = check_premultiplication(name, converters->convert) && ok;
+		}
+	}
+	return ok;
+}
+
+int main(void) {
+	static uint8_t src[4 * MAX_WIDTH + MAX_OFFSET];
+	for (size_t i = 0; i < sizeof(src); ++i) {
+		src[i] = next_byte();
+	}
+	bool ok = check_variants("rgb", rgb_row_converters, src, 3);
+	ok = check_variants("rgba", rgba_row_converters, src, 4) && ok;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
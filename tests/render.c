@@ -0,0 +1,1361 @@
+/*
+ * Runs swaybg against a compositor implemented here with libwayland-server,
+ * connected over a socket pair, and checks what it draws: the buffers it
+ * attaches, their damage, scale and viewport, and their pixels. Events are
+ * sent the way a compositor would send them, including outputs that come and
+ * go, scale changes and layer surfaces that are closed.
+ *
+ * Usage: test-render <path to swaybg>
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <cairo.h>
+#include <wayland-server.h>
+#include "fractional-scale-v1-server-protocol.h"
+#include "viewporter-server-protocol.h"
+#include "wlr-layer-shell-unstable-v1-server-protocol.h"
+#include "xdg-output-unstable-v1-server-protocol.h"
+
+#define OUTPUT_WIDTH 1920
+#define OUTPUT_HEIGHT 1080
+#define TIMEOUT_MS 10000
+
+#define BACKGROUND_COLOR 0xFF336699
+#define IMAGE_COLOR 0xFF884422
+#define SQUARE_COLOR 0xFFCC0000
+#define SQUARE_X 72
+#define SQUARE_Y 72
+#define SQUARE_SIZE 16
+
+struct compositor {
+	struct wl_display *display;
+	struct wl_client *client;
+	struct wl_listener client_destroy;
+	pid_t pid;
+
+	struct wl_list outputs; // struct output
+	struct wl_list surfaces; // struct surface
+	struct wl_list buffers; // struct buffer
+	int buffers_attached; // distinct wl_buffers ever attached
+	int acks;
+	int destroyed_surfaces;
+	uint32_t serial;
+
+	char dir[32];
+	char control_path[64];
+};
+
+struct output {
+	struct compositor *compositor;
+	struct wl_global *global;
+	struct wl_list resources; // wl_output
+	char name[16];
+	int32_t scale;
+	uint32_t preferred_scale; // in 120ths, sent with fractional-scale
+	struct wl_list link;
+};
+
+struct buffer {
+	struct compositor *compositor;
+	struct wl_resource *resource;
+	struct wl_listener destroy;
+	struct wl_list link;
+};
+
+struct damage {
+	bool full;
+	int rects;
+	int64_t pixels;
+	int32_t x0, y0, x1, y1; // bounds of the rects
+};
+
+struct surface_state {
+	struct wl_resource *buffer;
+	bool attached;
+	int32_t buffer_scale;
+	int32_t viewport_width, viewport_height; // -1 without a viewport
+	bool opaque;
+	struct damage damage;
+};
+
+struct surface {
+	struct compositor *compositor;
+	struct wl_resource *resource;
+	struct wl_resource *layer_surface, *viewport, *fractional_scale;
+	struct output *output;
+	bool configured;
+	// What the next commit applies, and what the last one did
+	struct surface_state pending, current;
+	int commits;
+	struct wl_list link;
+};
+
+struct region {
+	int64_t area;
+};
+
+static bool failed = false;
+
+static void expect(bool ok, const char *step, const char *what) {
+	if (!ok) {
+		fprintf(stderr, "%s: expected %s\n", step, what);
+		failed = true;
+	}
+}
+
+#define EXPECT(step, cond) expect((cond), (step), #cond)
+
+static void *zalloc(size_t size) {
+	void *ptr = calloc(1, size);
+	if (!ptr) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return ptr;
+}
+
+static void resource_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void unlink_resource(struct wl_resource *resource) {
+	wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void reset_damage(struct damage *damage) {
+	*damage = (struct damage){
+		.x0 = INT32_MAX,
+		.y0 = INT32_MAX,
+		.x1 = INT32_MIN,
+		.y1 = INT32_MIN,
+	};
+}
+
+// wl_buffer, tracked to count distinct buffers and to forget destroyed ones
+
+static void handle_buffer_destroy(struct wl_listener *listener, void *data) {
+	struct buffer *buffer = wl_container_of(listener, buffer, destroy);
+	struct surface *surface;
+	wl_list_for_each(surface, &buffer->compositor->surfaces, link) {
+		if (surface->pending.buffer == buffer->resource) {
+			surface->pending.buffer = NULL;
+		}
+		if (surface->current.buffer == buffer->resource) {
+			surface->current.buffer = NULL;
+		}
+	}
+	wl_list_remove(&buffer->destroy.link);
+	wl_list_remove(&buffer->link);
+	free(buffer);
+}
+
+static void track_buffer(struct compositor *compositor,
+		struct wl_resource *resource) {
+	struct buffer *buffer;
+	wl_list_for_each(buffer, &compositor->buffers, link) {
+		if (buffer->resource == resource) {
+			return;
+		}
+	}
+	buffer = zalloc(sizeof(struct buffer));
+	buffer->compositor = compositor;
+	buffer->resource = resource;
+	buffer->destroy.notify = handle_buffer_destroy;
+	wl_resource_add_destroy_listener(resource, &buffer->destroy);
+	wl_list_insert(&compositor->buffers, &buffer->link);
+	compositor->buffers_attached++;
+}
+
+// wl_region, of which only the area matters
+
+static void region_add(struct wl_client *client, struct wl_resource *resource,
+		int32_t x, int32_t y, int32_t width, int32_t height) {
+	struct region *region = wl_resource_get_user_data(resource);
+	region->area += (int64_t)width * height;
+}
+
+static void region_subtract(struct wl_client *client,
+		struct wl_resource *resource, int32_t x, int32_t y,
+		int32_t width, int32_t height) {
+	struct region *region = wl_resource_get_user_data(resource);
+	region->area -= (int64_t)width * height;
+}
+
+static const struct wl_region_interface region_impl = {
+	.destroy = resource_destroy,
+	.add = region_add,
+	.subtract = region_subtract,
+};
+
+static void region_resource_destroy(struct wl_resource *resource) {
+	free(wl_resource_get_user_data(resource));
+}
+
+// wl_surface
+
+static void send_configure(struct surface *surface) {
+	zwlr_layer_surface_v1_send_configure(surface->layer_surface,
+			++surface->compositor->serial, OUTPUT_WIDTH, OUTPUT_HEIGHT);
+}
+
+static void surface_attach(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *buffer,
+		int32_t x, int32_t y) {
+	struct surface *surface = wl_resource_get_user_data(resource);
+	surface->pending.buffer = buffer;
+	surface->pending.attached = true;
+	if (buffer) {
+		track_buffer(surface->compositor, buffer);
+	}
+}
+
+static void surface_damage(struct wl_client *client,
+		struct wl_resource *resource, int32_t x, int32_t y,
+		int32_t width, int32_t height) {
+	fprintf(stderr, "Damage in surface coordinates, "
+			"swaybg only sends buffer damage\n");
+	failed = true;
+}
+
+static void surface_frame(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct wl_resource *callback =
+		wl_resource_create(client, &wl_callback_interface, 1, id);
+	if (!callback) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_callback_send_done(callback, 0);
+	wl_resource_destroy(callback);
+}
+
+static void surface_set_opaque_region(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *region_resource) {
+	struct surface *surface = wl_resource_get_user_data(resource);
+	struct region *region = region_resource ?
+		wl_resource_get_user_data(region_resource) : NULL;
+	surface->pending.opaque = region &&
+		region->area == (int64_t)OUTPUT_WIDTH * OUTPUT_HEIGHT;
+}
+
+static void surface_set_input_region(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *region) {
+	// Nothing here sends input
+}
+
+static void surface_commit(struct wl_client *client,
+		struct wl_resource *resource) {
+	struct surface *surface = wl_resource_get_user_data(resource);
+	if (!surface->layer_surface) {
+		return;
+	}
+	if (!surface->configured) {
+		// The initial commit, which asks for the first configure
+		surface->configured = true;
+		send_configure(surface);
+		return;
+	}
+
+	struct wl_resource *previous = surface->current.buffer;
+	surface->current = surface->pending;
+	if (!surface->pending.attached) {
+		surface->current.buffer = previous;
+	}
+	// Done with the buffer that was replaced
+	if (previous && previous != surface->current.buffer) {
+		wl_buffer_send_release(previous);
+	}
+	surface->pending.attached = false;
+	reset_damage(&surface->pending.damage);
+	surface->commits++;
+}
+
+static void surface_set_buffer_transform(struct wl_client *client,
+		struct wl_resource *resource, int32_t transform) {
+	// Never set by swaybg
+}
+
+static void surface_set_buffer_scale(struct wl_client *client,
+		struct wl_resource *resource, int32_t scale) {
+	struct surface *surface = wl_resource_get_user_data(resource);
+	surface->pending.buffer_scale = scale;
+}
+
+static void surface_damage_buffer(struct wl_client *client,
+		struct wl_resource *resource, int32_t x, int32_t y,
+		int32_t width, int32_t height) {
+	struct surface *surface = wl_resource_get_user_data(resource);
+	struct damage *damage = &surface->pending.damage;
+	if (x == 0 && y == 0 && width == INT32_MAX && height == INT32_MAX) {
+		damage->full = true;
+		return;
+	}
+	damage->rects++;
+	damage->pixels += (int64_t)width * height;
+	damage->x0 = x < damage->x0 ? x : damage->x0;
+	damage->y0 = y < damage->y0 ? y : damage->y0;
+	damage->x1 = x + width > damage->x1 ? x + width : damage->x1;
+	damage->y1 = y + height > damage->y1 ? y + height : damage->y1;
+}
+
+static const struct wl_surface_interface surface_impl = {
+	.destroy = resource_destroy,
+	.attach = surface_attach,
+	.damage = surface_damage,
+	.frame = surface_frame,
+	.set_opaque_region = surface_set_opaque_region,
+	.set_input_region = surface_set_input_region,
+	.commit = surface_commit,
+	.set_buffer_transform = surface_set_buffer_transform,
+	.set_buffer_scale = surface_set_buffer_scale,
+	.damage_buffer = surface_damage_buffer,
+};
+
+static void surface_resource_destroy(struct wl_resource *resource) {
+	struct surface *surface = wl_resource_get_user_data(resource);
+	// Objects that outlive the surface become inert
+	if (surface->layer_surface) {
+		wl_resource_set_user_data(surface->layer_surface, NULL);
+	}
+	if (surface->viewport) {
+		wl_resource_set_user_data(surface->viewport, NULL);
+	}
+	if (surface->fractional_scale) {
+		wl_resource_set_user_data(surface->fractional_scale, NULL);
+	}
+	surface->compositor->destroyed_surfaces++;
+	wl_list_remove(&surface->link);
+	free(surface);
+}
+
+// wl_compositor
+
+static void compositor_create_surface(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct compositor *compositor = wl_resource_get_user_data(resource);
+	struct surface *surface = zalloc(sizeof(struct surface));
+	surface->resource = wl_resource_create(client, &wl_surface_interface,
+			wl_resource_get_version(resource), id);
+	if (!surface->resource) {
+		free(surface);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	surface->compositor = compositor;
+	surface->pending.buffer_scale = 1;
+	surface->pending.viewport_width = -1;
+	surface->pending.viewport_height = -1;
+	reset_damage(&surface->pending.damage);
+	surface->current = surface->pending;
+	wl_resource_set_implementation(surface->resource, &surface_impl,
+			surface, surface_resource_destroy);
+	wl_list_insert(compositor->surfaces.prev, &surface->link);
+}
+
+static void compositor_create_region(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct region *region = zalloc(sizeof(struct region));
+	struct wl_resource *region_resource =
+		wl_resource_create(client, &wl_region_interface, 1, id);
+	if (!region_resource) {
+		free(region);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(region_resource, &region_impl,
+			region, region_resource_destroy);
+}
+
+static const struct wl_compositor_interface compositor_impl = {
+	.create_surface = compositor_create_surface,
+	.create_region = compositor_create_region,
+};
+
+static void bind_compositor(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource =
+		wl_resource_create(client, &wl_compositor_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &compositor_impl, data, NULL);
+}
+
+// wl_output
+
+static const struct wl_output_interface output_impl = {
+	.release = resource_destroy,
+};
+
+static void send_output_scale(struct output *output,
+		struct wl_resource *resource) {
+	if (wl_resource_get_version(resource) >= WL_OUTPUT_SCALE_SINCE_VERSION) {
+		wl_output_send_scale(resource, output->scale);
+	}
+	if (wl_resource_get_version(resource) >= WL_OUTPUT_DONE_SINCE_VERSION) {
+		wl_output_send_done(resource);
+	}
+}
+
+static void bind_output(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct output *output = data;
+	struct wl_resource *resource =
+		wl_resource_create(client, &wl_output_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &output_impl, output,
+			unlink_resource);
+	wl_list_insert(&output->resources, wl_resource_get_link(resource));
+	wl_output_send_geometry(resource, 0, 0, 600, 340,
+			WL_OUTPUT_SUBPIXEL_UNKNOWN, "Mock", "Output",
+			WL_OUTPUT_TRANSFORM_NORMAL);
+	wl_output_send_mode(resource, WL_OUTPUT_MODE_CURRENT,
+			OUTPUT_WIDTH * output->scale, OUTPUT_HEIGHT * output->scale,
+			60000);
+	if (version >= WL_OUTPUT_NAME_SINCE_VERSION) {
+		wl_output_send_name(resource, output->name);
+	}
+	send_output_scale(output, resource);
+}
+
+// zxdg_output_manager_v1
+
+static const struct zxdg_output_v1_interface xdg_output_impl = {
+	.destroy = resource_destroy,
+};
+
+static void xdg_output_manager_get_xdg_output(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *output_resource) {
+	struct output *output = wl_resource_get_user_data(output_resource);
+	struct wl_resource *xdg_output = wl_resource_create(client,
+			&zxdg_output_v1_interface, wl_resource_get_version(resource), id);
+	if (!xdg_output) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(xdg_output, &xdg_output_impl, NULL, NULL);
+	if (!output) {
+		// Unplugged already
+		return;
+	}
+	zxdg_output_v1_send_logical_position(xdg_output, 0, 0);
+	zxdg_output_v1_send_logical_size(xdg_output, OUTPUT_WIDTH, OUTPUT_HEIGHT);
+	int version = wl_resource_get_version(xdg_output);
+	if (version >= ZXDG_OUTPUT_V1_NAME_SINCE_VERSION) {
+		char description[64];
+		snprintf(description, sizeof(description), "Mock Output (%s)",
+				output->name);
+		zxdg_output_v1_send_name(xdg_output, output->name);
+		zxdg_output_v1_send_description(xdg_output, description);
+	}
+	// From version 3 on, wl_output.done takes its place
+	if (version < 3) {
+		zxdg_output_v1_send_done(xdg_output);
+	} else {
+		wl_output_send_done(output_resource);
+	}
+}
+
+static const struct zxdg_output_manager_v1_interface xdg_output_manager_impl = {
+	.destroy = resource_destroy,
+	.get_xdg_output = xdg_output_manager_get_xdg_output,
+};
+
+static void bind_xdg_output_manager(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+			&zxdg_output_manager_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &xdg_output_manager_impl,
+			data, NULL);
+}
+
+// zwlr_layer_shell_v1, whose surfaces always get the size of the output
+
+static void layer_surface_set_size(struct wl_client *client,
+		struct wl_resource *resource, uint32_t width, uint32_t height) {
+}
+
+static void layer_surface_set_anchor(struct wl_client *client,
+		struct wl_resource *resource, uint32_t anchor) {
+}
+
+static void layer_surface_set_exclusive_zone(struct wl_client *client,
+		struct wl_resource *resource, int32_t zone) {
+}
+
+static void layer_surface_set_margin(struct wl_client *client,
+		struct wl_resource *resource, int32_t top, int32_t right,
+		int32_t bottom, int32_t left) {
+}
+
+static void layer_surface_set_keyboard_interactivity(struct wl_client *client,
+		struct wl_resource *resource, uint32_t keyboard_interactivity) {
+}
+
+static void layer_surface_get_popup(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *popup) {
+}
+
+static void layer_surface_ack_configure(struct wl_client *client,
+		struct wl_resource *resource, uint32_t serial) {
+	struct surface *surface = wl_resource_get_user_data(resource);
+	if (surface) {
+		surface->compositor->acks++;
+	}
+}
+
+static const struct zwlr_layer_surface_v1_interface layer_surface_impl = {
+	.set_size = layer_surface_set_size,
+	.set_anchor = layer_surface_set_anchor,
+	.set_exclusive_zone = layer_surface_set_exclusive_zone,
+	.set_margin = layer_surface_set_margin,
+	.set_keyboard_interactivity = layer_surface_set_keyboard_interactivity,
+	.get_popup = layer_surface_get_popup,
+	.ack_configure = layer_surface_ack_configure,
+	.destroy = resource_destroy,
+};
+
+static void layer_surface_resource_destroy(struct wl_resource *resource) {
+	struct surface *surface = wl_resource_get_user_data(resource);
+	if (surface) {
+		surface->layer_surface = NULL;
+	}
+}
+
+static void layer_shell_get_layer_surface(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface_resource,
+		struct wl_resource *output_resource, uint32_t layer,
+		const char *namespace) {
+	struct surface *surface = wl_resource_get_user_data(surface_resource);
+	struct wl_resource *layer_surface = wl_resource_create(client,
+			&zwlr_layer_surface_v1_interface,
+			wl_resource_get_version(resource), id);
+	if (!layer_surface) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(layer_surface, &layer_surface_impl,
+			surface, layer_surface_resource_destroy);
+	surface->layer_surface = layer_surface;
+	surface->output = output_resource ?
+		wl_resource_get_user_data(output_resource) : NULL;
+	if (layer != ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND) {
+		fprintf(stderr, "Layer surface on layer %u\n", layer);
+		failed = true;
+	}
+}
+
+static const struct zwlr_layer_shell_v1_interface layer_shell_impl = {
+	.get_layer_surface = layer_shell_get_layer_surface,
+};
+
+static void bind_layer_shell(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+			&zwlr_layer_shell_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &layer_shell_impl, data, NULL);
+}
+
+// wp_viewporter
+
+static void viewport_set_source(struct wl_client *client,
+		struct wl_resource *resource, wl_fixed_t x, wl_fixed_t y,
+		wl_fixed_t width, wl_fixed_t height) {
+	// swaybg always shows whole buffers
+}
+
+static void viewport_set_destination(struct wl_client *client,
+		struct wl_resource *resource, int32_t width, int32_t height) {
+	struct surface *surface = wl_resource_get_user_data(resource);
+	if (surface) {
+		surface->pending.viewport_width = width;
+		surface->pending.viewport_height = height;
+	}
+}
+
+static const struct wp_viewport_interface viewport_impl = {
+	.destroy = resource_destroy,
+	.set_source = viewport_set_source,
+	.set_destination = viewport_set_destination,
+};
+
+static void viewport_resource_destroy(struct wl_resource *resource) {
+	struct surface *surface = wl_resource_get_user_data(resource);
+	if (surface) {
+		// Like the rest of the surface state, undone by the next commit
+		surface->pending.viewport_width = -1;
+		surface->pending.viewport_height = -1;
+		surface->viewport = NULL;
+	}
+}
+
+static void viewporter_get_viewport(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface_resource) {
+	struct surface *surface = wl_resource_get_user_data(surface_resource);
+	struct wl_resource *viewport = wl_resource_create(client,
+			&wp_viewport_interface, wl_resource_get_version(resource), id);
+	if (!viewport) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(viewport, &viewport_impl, surface,
+			viewport_resource_destroy);
+	surface->viewport = viewport;
+}
+
+static const struct wp_viewporter_interface viewporter_impl = {
+	.destroy = resource_destroy,
+	.get_viewport = viewporter_get_viewport,
+};
+
+static void bind_viewporter(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource =
+		wl_resource_create(client, &wp_viewporter_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &viewporter_impl, data, NULL);
+}
+
+// wp_fractional_scale_manager_v1
+
+static const struct wp_fractional_scale_v1_interface fractional_scale_impl = {
+	.destroy = resource_destroy,
+};
+
+static void fractional_scale_resource_destroy(struct wl_resource *resource) {
+	struct surface *surface = wl_resource_get_user_data(resource);
+	if (surface) {
+		surface->fractional_scale = NULL;
+	}
+}
+
+static void fractional_scale_manager_get_fractional_scale(
+		struct wl_client *client, struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface_resource) {
+	struct surface *surface = wl_resource_get_user_data(surface_resource);
+	struct wl_resource *fractional_scale = wl_resource_create(client,
+			&wp_fractional_scale_v1_interface,
+			wl_resource_get_version(resource), id);
+	if (!fractional_scale) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(fractional_scale, &fractional_scale_impl,
+			surface, fractional_scale_resource_destroy);
+	surface->fractional_scale = fractional_scale;
+	// The layer surface already tied the surface to its output
+	if (surface->output) {
+		wp_fractional_scale_v1_send_preferred_scale(fractional_scale,
+				surface->output->preferred_scale);
+	}
+}
+
+static const struct wp_fractional_scale_manager_v1_interface
+		fractional_scale_manager_impl = {
+	.destroy = resource_destroy,
+	.get_fractional_scale = fractional_scale_manager_get_fractional_scale,
+};
+
+static void bind_fractional_scale_manager(struct wl_client *client,
+		void *data, uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+			&wp_fractional_scale_manager_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &fractional_scale_manager_impl,
+			data, NULL);
+}
+
+// Setting up and driving the compositor
+
+static struct compositor *compositor_create(bool viewporter) {
+	struct compositor *compositor = zalloc(sizeof(struct compositor));
+	wl_list_init(&compositor->outputs);
+	wl_list_init(&compositor->surfaces);
+	wl_list_init(&compositor->buffers);
+	compositor->display = wl_display_create();
+	if (!compositor->display ||
+			wl_display_init_shm(compositor->display) != 0 ||
+			!wl_global_create(compositor->display, &wl_compositor_interface,
+				4, compositor, bind_compositor) ||
+			!wl_global_create(compositor->display,
+				&zwlr_layer_shell_v1_interface, 1, compositor,
+				bind_layer_shell) ||
+			!wl_global_create(compositor->display,
+				&zxdg_output_manager_v1_interface, 3, compositor,
+				bind_xdg_output_manager)) {
+		fprintf(stderr, "Failed to set up the compositor\n");
+		exit(EXIT_FAILURE);
+	}
+	if (viewporter && (!wl_global_create(compositor->display,
+				&wp_viewporter_interface, 1, compositor, bind_viewporter) ||
+			!wl_global_create(compositor->display,
+				&wp_fractional_scale_manager_v1_interface, 1, compositor,
+				bind_fractional_scale_manager))) {
+		fprintf(stderr, "Failed to set up the compositor\n");
+		exit(EXIT_FAILURE);
+	}
+
+	snprintf(compositor->dir, sizeof(compositor->dir),
+			"/tmp/swaybg-test.XXXXXX");
+	if (!mkdtemp(compositor->dir)) {
+		fprintf(stderr, "Failed to create %s: %s\n", compositor->dir,
+				strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	snprintf(compositor->control_path, sizeof(compositor->control_path),
+			"%s/control", compositor->dir);
+	return compositor;
+}
+
+static struct output *add_output(struct compositor *compositor,
+		const char *name) {
+	struct output *output = zalloc(sizeof(struct output));
+	output->compositor = compositor;
+	wl_list_init(&output->resources);
+	snprintf(output->name, sizeof(output->name), "%s", name);
+	output->scale = 1;
+	output->preferred_scale = 120;
+	output->global = wl_global_create(compositor->display,
+			&wl_output_interface, 4, output, bind_output);
+	if (!output->global) {
+		fprintf(stderr, "Failed to create output %s\n", name);
+		exit(EXIT_FAILURE);
+	}
+	wl_list_insert(compositor->outputs.prev, &output->link);
+	return output;
+}
+
+// Like unplugging it, clients are told that the global is gone
+static void remove_output(struct output *output) {
+	struct wl_resource *resource, *tmp;
+	wl_resource_for_each_safe(resource, tmp, &output->resources) {
+		wl_resource_set_user_data(resource, NULL);
+		wl_list_remove(wl_resource_get_link(resource));
+		wl_list_init(wl_resource_get_link(resource));
+	}
+	struct surface *surface;
+	wl_list_for_each(surface, &output->compositor->surfaces, link) {
+		if (surface->output == output) {
+			surface->output = NULL;
+		}
+	}
+	wl_global_destroy(output->global);
+	wl_list_remove(&output->link);
+	free(output);
+}
+
+static void set_output_scale(struct output *output, int32_t scale) {
+	output->scale = scale;
+	struct wl_resource *resource;
+	wl_resource_for_each(resource, &output->resources) {
+		send_output_scale(output, resource);
+	}
+}
+
+static void set_preferred_scale(struct output *output, uint32_t scale) {
+	output->preferred_scale = scale;
+	struct surface *surface;
+	wl_list_for_each(surface, &output->compositor->surfaces, link) {
+		if (surface->output == output && surface->fractional_scale) {
+			wp_fractional_scale_v1_send_preferred_scale(
+					surface->fractional_scale, scale);
+		}
+	}
+}
+
+static struct surface *output_surface(struct output *output) {
+	struct surface *surface;
+	wl_list_for_each(surface, &output->compositor->surfaces, link) {
+		if (surface->output == output && surface->layer_surface) {
+			return surface;
+		}
+	}
+	return NULL;
+}
+
+static int64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void dispatch(struct compositor *compositor, int timeout) {
+	wl_display_flush_clients(compositor->display);
+	wl_event_loop_dispatch(wl_display_get_event_loop(compositor->display),
+			timeout);
+	wl_display_flush_clients(compositor->display);
+}
+
+/*
+ * Handles requests until done returns true. Fails the test if swaybg goes
+ * away or takes too long.
+ */
+static bool wait_for(struct compositor *compositor,
+		bool (*done)(struct compositor *compositor, void *data), void *data,
+		const char *what) {
+	int64_t deadline = now_ms() + TIMEOUT_MS;
+	while (!done(compositor, data)) {
+		if (!compositor->client) {
+			fprintf(stderr, "swaybg exited while waiting for %s\n", what);
+			failed = true;
+			return false;
+		}
+		int64_t left = deadline - now_ms();
+		if (left <= 0) {
+			fprintf(stderr, "Timed out waiting for %s\n", what);
+			failed = true;
+			return false;
+		}
+		dispatch(compositor, left < 100 ? (int)left : 100);
+	}
+	return true;
+}
+
+struct commit_wait {
+	struct output *output;
+	int commits;
+};
+
+static bool has_commits(struct compositor *compositor, void *data) {
+	struct commit_wait *wait = data;
+	struct surface *surface = output_surface(wait->output);
+	return surface && surface->commits >= wait->commits &&
+		surface->current.buffer;
+}
+
+// Waits until the surface of output has been committed count times
+static struct surface *wait_for_commits(struct output *output, int count) {
+	struct commit_wait wait = { output, count };
+	if (!wait_for(output->compositor, has_commits, &wait, "a commit")) {
+		return NULL;
+	}
+	return output_surface(output);
+}
+
+static bool has_acks(struct compositor *compositor, void *data) {
+	return compositor->acks >= *(int *)data;
+}
+
+static bool has_destroyed_surfaces(struct compositor *compositor,
+		void *data) {
+	return compositor->destroyed_surfaces >= *(int *)data;
+}
+
+static bool wait_for_destroyed_surfaces(struct compositor *compositor,
+		int count) {
+	return wait_for(compositor, has_destroyed_surfaces, &count,
+			"a surface to be destroyed");
+}
+
+/*
+ * Events are handled in order, and swaybg renders before it waits for more.
+ * Once a configure sent after other events is acked, whatever those events
+ * made swaybg draw right away has been committed too.
+ */
+static bool sync_client(struct surface *surface) {
+	struct compositor *compositor = surface->compositor;
+	int acks = compositor->acks + 1;
+	send_configure(surface);
+	if (!wait_for(compositor, has_acks, &acks, "a configure to be acked")) {
+		return false;
+	}
+	dispatch(compositor, 0);
+	return true;
+}
+
+// Lets swaybg draw into the buffer again, as if it had been copied
+static void release_buffer(struct surface *surface) {
+	if (surface->current.buffer) {
+		wl_buffer_send_release(surface->current.buffer);
+	}
+}
+
+static struct wl_shm_buffer *current_shm_buffer(struct surface *surface) {
+	struct wl_shm_buffer *buffer = surface->current.buffer ?
+		wl_shm_buffer_get(surface->current.buffer) : NULL;
+	if (!buffer) {
+		fprintf(stderr, "Surface has no shm buffer\n");
+		failed = true;
+	}
+	return buffer;
+}
+
+static int32_t buffer_width(struct surface *surface) {
+	struct wl_shm_buffer *buffer = current_shm_buffer(surface);
+	return buffer ? wl_shm_buffer_get_width(buffer) : 0;
+}
+
+static int32_t buffer_height(struct surface *surface) {
+	struct wl_shm_buffer *buffer = current_shm_buffer(surface);
+	return buffer ? wl_shm_buffer_get_height(buffer) : 0;
+}
+
+// A pixel of the committed buffer, opaque if the buffer has no alpha
+static uint32_t read_pixel(struct surface *surface, int x, int y) {
+	struct wl_shm_buffer *buffer = current_shm_buffer(surface);
+	if (!buffer) {
+		return 0;
+	}
+	wl_shm_buffer_begin_access(buffer);
+	const uint8_t *data = wl_shm_buffer_get_data(buffer);
+	uint32_t pixel = ((const uint32_t *)(data +
+			(size_t)y * wl_shm_buffer_get_stride(buffer)))[x];
+	if (wl_shm_buffer_get_format(buffer) == WL_SHM_FORMAT_XRGB8888) {
+		pixel |= 0xFF000000;
+	}
+	wl_shm_buffer_end_access(buffer);
+	return pixel;
+}
+
+static uint32_t center_pixel(struct surface *surface) {
+	return read_pixel(surface, buffer_width(surface) / 2,
+			buffer_height(surface) / 2);
+}
+
+static void handle_client_destroy(struct wl_listener *listener, void *data) {
+	struct compositor *compositor =
+		wl_container_of(listener, compositor, client_destroy);
+	compositor->client = NULL;
+}
+
+// Runs swaybg connected to the compositor, args ends with NULL
+static void start_swaybg(struct compositor *compositor, const char *swaybg,
+		const char **args) {
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+		fprintf(stderr, "Failed to create a socket pair: %s\n",
+				strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	compositor->client = wl_client_create(compositor->display, fds[0]);
+	if (!compositor->client) {
+		fprintf(stderr, "Failed to create the client\n");
+		exit(EXIT_FAILURE);
+	}
+	compositor->client_destroy.notify = handle_client_destroy;
+	wl_client_add_destroy_listener(compositor->client,
+			&compositor->client_destroy);
+
+	const char *argv[16] = { swaybg, "--no-cache" };
+	size_t argc = 2;
+	for (; *args && argc < sizeof(argv) / sizeof(argv[0]) - 1; ++args) {
+		argv[argc++] = *args;
+	}
+
+	compositor->pid = fork();
+	if (compositor->pid < 0) {
+		fprintf(stderr, "Failed to fork: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	} else if (compositor->pid == 0) {
+		// Unlike the original, the duplicate is inherited across exec
+		int fd = dup(fds[1]);
+		char fd_str[16];
+		snprintf(fd_str, sizeof(fd_str), "%d", fd);
+		if (fd < 0 || setenv("WAYLAND_SOCKET", fd_str, 1) != 0) {
+			_exit(127);
+		}
+		execv(swaybg, (char **)argv);
+		fprintf(stderr, "Failed to run %s: %s\n", swaybg, strerror(errno));
+		_exit(127);
+	}
+	close(fds[1]);
+}
+
+// Disconnects swaybg, which should then exit cleanly, and cleans up
+static void finish(struct compositor *compositor) {
+	if (compositor->client) {
+		wl_client_destroy(compositor->client);
+	}
+	int status = 0;
+	int64_t deadline = now_ms() + TIMEOUT_MS;
+	while (waitpid(compositor->pid, &status, WNOHANG) == 0) {
+		if (now_ms() > deadline) {
+			fprintf(stderr, "swaybg did not exit once disconnected\n");
+			kill(compositor->pid, SIGKILL);
+			waitpid(compositor->pid, &status, 0);
+			failed = true;
+			break;
+		}
+		struct timespec delay = { .tv_nsec = 10 * 1000 * 1000 };
+		nanosleep(&delay, NULL);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "swaybg exited with status %d\n", status);
+		failed = true;
+	}
+
+	struct output *output, *tmp;
+	wl_list_for_each_safe(output, tmp, &compositor->outputs, link) {
+		remove_output(output);
+	}
+	wl_display_destroy(compositor->display);
+	unlink(compositor->control_path);
+	rmdir(compositor->dir);
+	free(compositor);
+}
+
+// Sends one line to the control socket and waits for swaybg to accept it
+static void send_control(struct compositor *compositor, const char *line) {
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
+			compositor->control_path);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		fprintf(stderr, "Failed to connect to %s: %s\n",
+				compositor->control_path, strerror(errno));
+		failed = true;
+		if (fd >= 0) {
+			close(fd);
+		}
+		return;
+	}
+	char request[256];
+	int len = snprintf(request, sizeof(request), "%s\n", line);
+	if (write(fd, request, len) != len) {
+		fprintf(stderr, "Failed to send %s\n", line);
+		failed = true;
+		close(fd);
+		return;
+	}
+
+	// swaybg may be waiting for the compositor before it replies
+	char reply[256] = {0};
+	int64_t deadline = now_ms() + TIMEOUT_MS;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	while (poll(&pfd, 1, 0) == 0 && compositor->client &&
+			now_ms() < deadline) {
+		dispatch(compositor, 10);
+	}
+	if (!(pfd.revents & POLLIN) ||
+			read(fd, reply, sizeof(reply) - 1) <= 0 ||
+			strncmp(reply, "ok", 2) != 0) {
+		fprintf(stderr, "%s: expected ok, got \"%s\"\n", line, reply);
+		failed = true;
+	}
+	close(fd);
+}
+
+static void set_source_u32(cairo_t *cairo, uint32_t color) {
+	cairo_set_source_rgb(cairo, (color >> 16 & 0xFF) / 255.0,
+			(color >> 8 & 0xFF) / 255.0, (color & 0xFF) / 255.0);
+}
+
+// An image of the output's size, with a square in the corner if asked for
+static void write_image(const char *path, bool square) {
+	cairo_surface_t *image = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+			OUTPUT_WIDTH, OUTPUT_HEIGHT);
+	cairo_t *cairo = cairo_create(image);
+	set_source_u32(cairo, IMAGE_COLOR);
+	cairo_paint(cairo);
+	if (square) {
+		set_source_u32(cairo, SQUARE_COLOR);
+		cairo_rectangle(cairo, SQUARE_X, SQUARE_Y, SQUARE_SIZE, SQUARE_SIZE);
+		cairo_fill(cairo);
+	}
+	cairo_destroy(cairo);
+	if (cairo_surface_write_to_png(image, path) != CAIRO_STATUS_SUCCESS) {
+		fprintf(stderr, "Failed to write %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	cairo_surface_destroy(image);
+}
+
+// Damaged in rectangles that cover the square and not much else
+static void expect_square_damage(const char *step, struct surface *surface) {
+	const struct damage *damage = &surface->current.damage;
+	EXPECT(step, !damage->full);
+	EXPECT(step, damage->rects > 0);
+	EXPECT(step, damage->x0 <= SQUARE_X && damage->y0 <= SQUARE_Y);
+	EXPECT(step, damage->x1 >= SQUARE_X + SQUARE_SIZE &&
+			damage->y1 >= SQUARE_Y + SQUARE_SIZE);
+	EXPECT(step, damage->pixels <= (int64_t)OUTPUT_WIDTH * OUTPUT_HEIGHT / 16);
+}
+
+static uint32_t square_pixel(struct surface *surface) {
+	return read_pixel(surface, SQUARE_X + SQUARE_SIZE / 2,
+			SQUARE_Y + SQUARE_SIZE / 2);
+}
+
+static void test_outputs(const char *swaybg) {
+	struct compositor *compositor = compositor_create(false);
+	struct output *first = add_output(compositor, "DP-1");
+	struct output *second = add_output(compositor, "DP-2");
+	const char *args[] = { "-c", "#336699", NULL };
+	start_swaybg(compositor, swaybg, args);
+
+	// Both outputs show the same frame
+	const char *step = "two outputs with the same color";
+	struct surface *a = wait_for_commits(first, 1);
+	struct surface *b = wait_for_commits(second, 1);
+	if (!a || !b) {
+		goto out;
+	}
+	EXPECT(step, a->current.buffer == b->current.buffer);
+	EXPECT(step, compositor->buffers_attached == 1);
+	EXPECT(step, buffer_width(a) == OUTPUT_WIDTH);
+	EXPECT(step, buffer_height(a) == OUTPUT_HEIGHT);
+	EXPECT(step, a->current.buffer_scale == 1);
+	EXPECT(step, a->current.damage.full);
+	EXPECT(step, a->current.opaque);
+	EXPECT(step, center_pixel(a) == BACKGROUND_COLOR);
+
+	// Compositors resend the same configure on many occasions
+	step = "configure with the same size";
+	if (!sync_client(a) || !sync_client(b)) {
+		goto out;
+	}
+	EXPECT(step, a->commits == 1 && b->commits == 1);
+
+	step = "output scale changed";
+	set_output_scale(first, 2);
+	if (!(a = wait_for_commits(first, 2))) {
+		goto out;
+	}
+	EXPECT(step, buffer_width(a) == 2 * OUTPUT_WIDTH);
+	EXPECT(step, buffer_height(a) == 2 * OUTPUT_HEIGHT);
+	EXPECT(step, a->current.buffer_scale == 2);
+	EXPECT(step, a->current.damage.full);
+	EXPECT(step, compositor->buffers_attached == 2);
+	EXPECT(step, center_pixel(a) == BACKGROUND_COLOR);
+	EXPECT(step, b->commits == 1);
+
+	// Shows the frame of the other output of its size
+	step = "output plugged in";
+	struct output *third = add_output(compositor, "HDMI-A-1");
+	struct surface *c = wait_for_commits(third, 1);
+	if (!c) {
+		goto out;
+	}
+	EXPECT(step, c->current.buffer == b->current.buffer);
+	EXPECT(step, compositor->buffers_attached == 2);
+
+	step = "output unplugged";
+	remove_output(second);
+	if (!wait_for_destroyed_surfaces(compositor, 1) ||
+			!sync_client(a) || !sync_client(c)) {
+		goto out;
+	}
+	EXPECT(step, a->commits == 2 && c->commits == 1);
+
+	step = "layer surface closed";
+	zwlr_layer_surface_v1_send_closed(c->layer_surface);
+	if (!wait_for_destroyed_surfaces(compositor, 2) || !sync_client(a)) {
+		goto out;
+	}
+	EXPECT(step, a->commits == 2);
+
+out:
+	finish(compositor);
+}
+
+static void test_fractional_scale(const char *swaybg) {
+	struct compositor *compositor = compositor_create(true);
+	struct output *output = add_output(compositor, "DP-1");
+	char image[64];
+	snprintf(image, sizeof(image), "%s/image.png", compositor->dir);
+	write_image(image, false);
+	const char *args[] = { "-c", "#336699", "-i", image, "-m", "fill",
+		"-s", compositor->control_path, NULL };
+	start_swaybg(compositor, swaybg, args);
+
+	const char *step = "image at a preferred scale of 1";
+	struct surface *surface = wait_for_commits(output, 1);
+	if (!surface) {
+		goto out;
+	}
+	EXPECT(step, buffer_width(surface) == OUTPUT_WIDTH);
+	EXPECT(step, buffer_height(surface) == OUTPUT_HEIGHT);
+	EXPECT(step, surface->current.buffer_scale == 1);
+	EXPECT(step, surface->current.viewport_width == OUTPUT_WIDTH);
+	EXPECT(step, surface->current.viewport_height == OUTPUT_HEIGHT);
+	EXPECT(step, center_pixel(surface) == IMAGE_COLOR);
+
+	step = "preferred scale of 1.5";
+	set_preferred_scale(output, 180);
+	if (!(surface = wait_for_commits(output, 2))) {
+		goto out;
+	}
+	EXPECT(step, buffer_width(surface) == OUTPUT_WIDTH * 3 / 2);
+	EXPECT(step, buffer_height(surface) == OUTPUT_HEIGHT * 3 / 2);
+	EXPECT(step, surface->current.buffer_scale == 1);
+	EXPECT(step, surface->current.viewport_width == OUTPUT_WIDTH);
+	EXPECT(step, surface->current.viewport_height == OUTPUT_HEIGHT);
+	EXPECT(step, surface->current.damage.full);
+	EXPECT(step, center_pixel(surface) == IMAGE_COLOR);
+
+	// The preferred scale is the more precise one
+	step = "integer scale changed under a preferred scale";
+	set_output_scale(output, 2);
+	if (!sync_client(surface)) {
+		goto out;
+	}
+	EXPECT(step, surface->commits == 2);
+
+	// A single pixel, scaled up by the compositor
+	step = "solid color with a viewport";
+	send_control(compositor, "* mode solid_color");
+	if (!(surface = wait_for_commits(output, 3))) {
+		goto out;
+	}
+	EXPECT(step, buffer_width(surface) == 1);
+	EXPECT(step, buffer_height(surface) == 1);
+	EXPECT(step, surface->current.viewport_width == OUTPUT_WIDTH);
+	EXPECT(step, surface->current.viewport_height == OUTPUT_HEIGHT);
+	EXPECT(step, read_pixel(surface, 0, 0) == BACKGROUND_COLOR);
+
+out:
+	unlink(image);
+	finish(compositor);
+}
+
+static void test_image_update(const char *swaybg) {
+	struct compositor *compositor = compositor_create(false);
+	struct output *output = add_output(compositor, "DP-1");
+	char first[64], second[64], command[128];
+	snprintf(first, sizeof(first), "%s/first.png", compositor->dir);
+	snprintf(second, sizeof(second), "%s/second.png", compositor->dir);
+	write_image(first, false);
+	write_image(second, true);
+	const char *args[] = { "-i", first, "-m", "fill",
+		"-s", compositor->control_path, NULL };
+	start_swaybg(compositor, swaybg, args);
+
+	const char *step = "image";
+	struct surface *surface = wait_for_commits(output, 1);
+	if (!surface) {
+		goto out;
+	}
+	EXPECT(step, surface->current.damage.full);
+	EXPECT(step, compositor->buffers_attached == 1);
+	EXPECT(step, center_pixel(surface) == IMAGE_COLOR);
+
+	// Drawn into the released buffer, only around the square is damaged
+	step = "image changed in a released buffer";
+	release_buffer(surface);
+	if (!sync_client(surface)) {
+		goto out;
+	}
+	snprintf(command, sizeof(command), "* image %s", second);
+	send_control(compositor, command);
+	if (!(surface = wait_for_commits(output, 2))) {
+		goto out;
+	}
+	EXPECT(step, compositor->buffers_attached == 1);
+	expect_square_damage(step, surface);
+	EXPECT(step, square_pixel(surface) == SQUARE_COLOR);
+	EXPECT(step, read_pixel(surface, 8, 8) == IMAGE_COLOR);
+
+	// The compositor may still read the buffer, so a new one is used,
+	// but the damage stays the same
+	step = "image changed in a busy buffer";
+	snprintf(command, sizeof(command), "* image %s", first);
+	send_control(compositor, command);
+	if (!(surface = wait_for_commits(output, 3))) {
+		goto out;
+	}
+	EXPECT(step, compositor->buffers_attached == 2);
+	expect_square_damage(step, surface);
+	EXPECT(step, square_pixel(surface) == IMAGE_COLOR);
+
+out:
+	unlink(first);
+	unlink(second);
+	finish(compositor);
+}
+
+static void test_shared_image_update(const char *swaybg) {
+	struct compositor *compositor = compositor_create(false);
+	struct output *outputs[] = {
+		add_output(compositor, "DP-1"),
+		add_output(compositor, "DP-2"),
+	};
+	char first[64], second[64], command[128];
+	snprintf(first, sizeof(first), "%s/first.png", compositor->dir);
+	snprintf(second, sizeof(second), "%s/second.png", compositor->dir);
+	write_image(first, false);
+	write_image(second, true);
+	const char *args[] = { "-i", first, "-m", "fill",
+		"-s", compositor->control_path, NULL };
+	start_swaybg(compositor, swaybg, args);
+
+	const char *step = "image on two outputs";
+	struct surface *a = wait_for_commits(outputs[0], 1);
+	struct surface *b = wait_for_commits(outputs[1], 1);
+	if (!a || !b) {
+		goto out;
+	}
+	EXPECT(step, a->current.buffer == b->current.buffer);
+	EXPECT(step, compositor->buffers_attached == 1);
+
+	// A single release does not tell whether the other surface is done
+	// with the buffer too
+	step = "image changed in a buffer shown twice";
+	release_buffer(a);
+	if (!sync_client(a)) {
+		goto out;
+	}
+	snprintf(command, sizeof(command), "* image %s", second);
+	send_control(compositor, command);
+	if (!(a = wait_for_commits(outputs[0], 2)) ||
+			!(b = wait_for_commits(outputs[1], 2))) {
+		goto out;
+	}
+	EXPECT(step, a->current.buffer == b->current.buffer);
+	EXPECT(step, compositor->buffers_attached == 2);
+	expect_square_damage(step, a);
+	expect_square_damage(step, b);
+	EXPECT(step, square_pixel(b) == SQUARE_COLOR);
+
+out:
+	unlink(first);
+	unlink(second);
+	finish(compositor);
+}
+
+int main(int argc, char **argv) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <path to swaybg>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	// Writing to a swaybg that is gone fails the test instead of killing it
+	signal(SIGPIPE, SIG_IGN);
+	test_outputs(argv[1]);
+	test_fractional_scale(argv[1]);
+	test_image_update(argv[1]);
+	test_shared_image_update(argv[1]);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
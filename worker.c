@@ -0,0 +1,322 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "log.h"
+#include "worker.h"
+
+#define MAX_WORKER_THREADS 64
+
+struct worker_job {
+	worker_func work;
+	worker_func done;
+	void *data;
+	struct worker_job *next;
+};
+
+struct worker_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct worker_job *queue_head, *queue_tail;
+	struct worker_job *done_head, *done_tail;
+	bool stopping;
+
+	pthread_t threads[MAX_WORKER_THREADS];
+	int thread_count;
+
+	// Wakes up the main loop when jobs have finished
+	int notify_fds[2];
+};
+
+struct band_group {
+	worker_band_func func;
+	void *data;
+	int next, count, finished;
+	int refs; // the caller plus one per queued helper job
+	pthread_cond_t cond;
+};
+
+static bool set_nonblock_cloexec(int fd) {
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		return false;
+	}
+	flags = fcntl(fd, F_GETFD);
+	if (flags == -1 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1) {
+		return false;
+	}
+	return true;
+}
+
+// Must be called with the pool locked
+static void finish_job(struct worker_pool *pool, struct worker_job *job) {
+	if (!job->done) {
+		free(job);
+		return;
+	}
+	job->next = NULL;
+	if (pool->done_tail) {
+		pool->done_tail->next = job;
+	} else {
+		pool->done_head = job;
+	}
+	pool->done_tail = job;
+
+	char byte = 0;
+	// A full pipe already guarantees a wakeup
+	write(pool->notify_fds[1], &byte, 1);
+}
+
+static void *worker_thread(void *data) {
+	struct worker_pool *pool = data;
+	pthread_mutex_lock(&pool->lock);
+	while (true) {
+		while (!pool->queue_head && !pool->stopping) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		}
+		if (pool->stopping) {
+			break;
+		}
+		struct worker_job *job = pool->queue_head;
+		pool->queue_head = job->next;
+		if (!pool->queue_head) {
+			pool->queue_tail = NULL;
+		}
+
+		pthread_mutex_unlock(&pool->lock);
+		job->work(job->data);
+		pthread_mutex_lock(&pool->lock);
+
+		finish_job(pool, job);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct worker_pool *worker_pool_create(void) {
+	struct worker_pool *pool = calloc(1, sizeof(struct worker_pool));
+	if (!pool) {
+		return NULL;
+	}
+	if (pipe(pool->notify_fds) == -1) {
+		swaybg_log_errno(LOG_ERROR, "Failed to create worker pipe");
+		free(pool);
+		return NULL;
+	}
+	if (!set_nonblock_cloexec(pool->notify_fds[0]) ||
+			!set_nonblock_cloexec(pool->notify_fds[1])) {
+		swaybg_log_errno(LOG_ERROR, "Failed to configure worker pipe");
+		close(pool->notify_fds[0]);
+		close(pool->notify_fds[1]);
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	// The thread calling worker_pool_run_bands helps out as well
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int count = cpus > 1 ? cpus - 1 : 1;
+	if (count > MAX_WORKER_THREADS) {
+		count = MAX_WORKER_THREADS;
+	}
+	for (int i = 0; i < count; ++i) {
+		if (pthread_create(&pool->threads[i], NULL,
+				worker_thread, pool) != 0) {
+			swaybg_log(LOG_ERROR, "Failed to start worker thread");
+			break;
+		}
+		pool->thread_count++;
+	}
+	swaybg_log(LOG_DEBUG, "Started %d worker threads", pool->thread_count);
+	return pool;
+}
+
+void worker_pool_destroy(struct worker_pool *pool) {
+	if (!pool) {
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	for (int i = 0; i < pool->thread_count; ++i) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	struct worker_job *job = pool->queue_head;
+	while (job) {
+		struct worker_job *next = job->next;
+		if (job->done) {
+			job->done(job->data);
+		} else {
+			// Leftover band helpers, which only need to drop their group
+			job->work(job->data);
+		}
+		free(job);
+		job = next;
+	}
+	worker_pool_dispatch(pool);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	close(pool->notify_fds[0]);
+	close(pool->notify_fds[1]);
+	free(pool);
+}
+
+static struct worker_job *create_job(worker_func work, worker_func done,
+		void *data) {
+	struct worker_job *job = calloc(1, sizeof(struct worker_job));
+	if (!job) {
+		swaybg_log(LOG_ERROR, "Failed to allocate worker job");
+		return NULL;
+	}
+	job->work = work;
+	job->done = done;
+	job->data = data;
+	return job;
+}
+
+bool worker_pool_submit(struct worker_pool *pool, worker_func work,
+		worker_func done, void *data) {
+	struct worker_job *job = create_job(work, done, data);
+	if (!job) {
+		return false;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->thread_count == 0) {
+		// No threads could be started, at least keep the job's contract
+		pthread_mutex_unlock(&pool->lock);
+		work(data);
+		pthread_mutex_lock(&pool->lock);
+		finish_job(pool, job);
+	} else {
+		if (pool->queue_tail) {
+			pool->queue_tail->next = job;
+		} else {
+			pool->queue_head = job;
+		}
+		pool->queue_tail = job;
+		pthread_cond_signal(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return true;
+}
+
+int worker_pool_get_fd(struct worker_pool *pool) {
+	return pool->notify_fds[0];
+}
+
+void worker_pool_dispatch(struct worker_pool *pool) {
+	char buf[64];
+	while (read(pool->notify_fds[0], buf, sizeof(buf)) > 0) {
+		// Drain
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	struct worker_job *job = pool->done_head;
+	pool->done_head = pool->done_tail = NULL;
+	pthread_mutex_unlock(&pool->lock);
+
+	while (job) {
+		struct worker_job *next = job->next;
+		job->done(job->data);
+		free(job);
+		job = next;
+	}
+}
+
+// Must be called with the pool locked
+static void unref_band_group(struct band_group *group) {
+	if (--group->refs == 0) {
+		pthread_cond_destroy(&group->cond);
+		free(group);
+	}
+}
+
+static void run_band_group(struct worker_pool *pool,
+		struct band_group *group) {
+	pthread_mutex_lock(&pool->lock);
+	while (group->next < group->count) {
+		int index = group->next++;
+		pthread_mutex_unlock(&pool->lock);
+		group->func(group->data, index);
+		pthread_mutex_lock(&pool->lock);
+		if (++group->finished == group->count) {
+			pthread_cond_broadcast(&group->cond);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+struct band_helper {
+	struct worker_pool *pool;
+	struct band_group *group;
+};
+
+static void band_helper_work(void *data) {
+	struct band_helper *helper = data;
+	run_band_group(helper->pool, helper->group);
+	pthread_mutex_lock(&helper->pool->lock);
+	unref_band_group(helper->group);
+	pthread_mutex_unlock(&helper->pool->lock);
+	free(helper);
+}
+
+void worker_pool_run_bands(struct worker_pool *pool, worker_band_func func,
+		void *data, int count) {
+	struct band_group *group = calloc(1, sizeof(struct band_group));
+	if (!group) {
+		for (int i = 0; i < count; ++i) {
+			func(data, i);
+		}
+		return;
+	}
+	group->func = func;
+	group->data = data;
+	group->count = count;
+	group->refs = 1;
+	pthread_cond_init(&group->cond, NULL);
+
+	pthread_mutex_lock(&pool->lock);
+	int helpers = count - 1 < pool->thread_count ?
+		count - 1 : pool->thread_count;
+	for (int i = 0; i < helpers; ++i) {
+		struct band_helper *helper = malloc(sizeof(struct band_helper));
+		struct worker_job *job = helper ?
+			create_job(band_helper_work, NULL, helper) : NULL;
+		if (!job) {
+			free(helper);
+			break;
+		}
+		helper->pool = pool;
+		helper->group = group;
+		group->refs++;
+		// Bands go ahead of queued jobs, someone is waiting for them
+		job->next = pool->queue_head;
+		pool->queue_head = job;
+		if (!pool->queue_tail) {
+			pool->queue_tail = job;
+		}
+	}
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	// Helpers that only start after all bands were taken return right away,
+	// so never wait for them, only for the bands themselves
+	run_band_group(pool, group);
+	pthread_mutex_lock(&pool->lock);
+	while (group->finished < group->count) {
+		pthread_cond_wait(&group->cond, &pool->lock);
+	}
+	unref_band_group(group);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int worker_pool_get_thread_count(struct worker_pool *pool) {
+	return pool->thread_count;
+}